@@ -0,0 +1,344 @@
+/*
+    Compare signature engines on the same input.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utf8.h>
+#include <nlohmann/json.hpp>
+#include "common.h"
+#include "json_text.h"
+#include "minhash.h"
+
+using json = nlohmann::json;
+
+/*
+    Statistics of a signature engine.
+*/
+struct engine_stat {
+    signature_engine se;
+    int feature = FEATURE_BYTES;
+    double seconds = 0.;
+    size_t num_signatures = 0;
+    size_t num_hash_calls = 0;
+    double error_near = 0.;
+    size_t hits_near = 0;
+    double error_far = 0.;
+    size_t hits_far = 0;
+    std::vector<uint32_t> prev;
+};
+
+/*
+    Obtain the n-grams of the text in the same manner as doubri-minhash.
+*/
+ngram_view features(std::string& text, std::vector<const char *>& cs, size_t n)
+{
+    if (find_letters(text, cs) < n) {
+        text = "EMPTY";
+        find_letters(text, cs);
+    }
+    return ngram_of_letters(text, n, cs);
+}
+
+double jaccard(const ngram_view& xv, const ngram_view& yv)
+{
+    std::vector<std::string_view> x(xv.begin(), xv.end());
+    std::sort(x.begin(), x.end());
+    x.erase(std::unique(x.begin(), x.end()), x.end());
+    std::vector<std::string_view> y(yv.begin(), yv.end());
+    std::sort(y.begin(), y.end());
+    y.erase(std::unique(y.begin(), y.end()), y.end());
+
+    std::vector<std::string_view> common;
+    std::set_intersection(x.begin(), x.end(), y.begin(), y.end(), std::back_inserter(common));
+    const size_t num_union = x.size() + y.size() - common.size();
+    return num_union ? common.size() / (double)num_union : 1.;
+}
+
+/*
+    The ratio of matching MinHash values and whether any of b buckets of r
+    values matches.
+*/
+double estimate(const uint32_t *x, const uint32_t *y, size_t b, size_t r, bool& hit)
+{
+    size_t num_match = 0;
+    hit = false;
+    for (size_t i = 0; i < b; ++i) {
+        size_t n = 0;
+        for (size_t j = 0; j < r; ++j) {
+            n += (x[i*r+j] == y[i*r+j]);
+        }
+        num_match += n;
+        hit |= (n == r);
+    }
+    return num_match / (double)(b * r);
+}
+
+/*
+    Compare the JSON parser (DOM) and the scanner of the "text" field.
+*/
+int bench_parse(std::istream& is, std::ostream& os, std::ostream& es)
+{
+    std::vector<std::string> lines;
+    size_t num_bytes = 0;
+    for (;;) {
+        std::string line;
+        std::getline(is, line);
+        if (is.eof()) {
+            break;
+        }
+        num_bytes += line.size() + 1;
+        lines.push_back(std::move(line));
+    }
+
+    // The DOM parser.
+    std::vector<std::string> expected(lines.size());
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lines.size(); ++i) {
+        auto d = json::parse(lines[i]);
+        if (d.contains("text")) {
+            expected[i] = d["text"];
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    const double seconds_dom = std::chrono::duration<double>(end - begin).count();
+
+    // The scanner.
+    json_text_scanner scanner;
+    std::string text;
+    size_t num_fallbacks = 0;
+    size_t num_mismatches = 0;
+    double seconds_scanner = 0.;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        begin = std::chrono::steady_clock::now();
+        const bool ok = scanner.extract(lines[i], text);
+        end = std::chrono::steady_clock::now();
+        seconds_scanner += std::chrono::duration<double>(end - begin).count();
+        if (!ok) {
+            ++num_fallbacks;
+        } else if (text != expected[i]) {
+            es << "WARNING: the scanner extracted a different text (line " << i + 1 << ")" << std::endl;
+            ++num_mismatches;
+        }
+    }
+
+    const double mb = num_bytes / 1e6;
+    os << '{' <<
+        kv("parser", "dom") << ", " <<
+        kv("num_lines", lines.size()) << ", " <<
+        kv("seconds", seconds_dom) << ", " <<
+        kv("mb_per_sec", mb / seconds_dom) <<
+        '}' << std::endl;
+    os << '{' <<
+        kv("parser", "scanner") << ", " <<
+        kv("num_lines", lines.size()) << ", " <<
+        kv("seconds", seconds_scanner) << ", " <<
+        kv("mb_per_sec", mb / seconds_scanner) << ", " <<
+        kv("num_fallbacks", num_fallbacks) << ", " <<
+        kv("num_mismatches", num_mismatches) <<
+        '}' << std::endl;
+    return num_mismatches ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = NGRAM_SIZE;
+    size_t b = NUM_BUCKETS;
+    size_t r = BUCKET_SIZE;
+    uint64_t seed = 0;
+    size_t num_docs = 0;
+    std::istream& is = std::cin;
+    std::ostream& os = std::cout;
+    std::ostream& es = std::cerr;
+
+    std::vector<std::string> names{"murmur32", "murmur128", "permute", "oph"};
+    auto usage = [&]() {
+        es << "USAGE: " << argv[0] << " [--engines murmur32,murmur128,permute,oph,permute+rolling,oph+rolling] [--seed N] [-n N] [-b B] [-r R] < JSONL" << std::endl;
+        es << "       " << argv[0] << " --parse < JSONL" << std::endl;
+        return 1;
+    };
+    auto invalid = [&](std::string_view arg, const char *value) {
+        es << "ERROR: invalid value for " << arg << ": " << value << std::endl;
+        return usage();
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "--seed" && i + 1 < argc) {
+            if (!parse_number(argv[++i], seed, 0, UINT64_MAX)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "-n" && i + 1 < argc) {
+            if (!parse_number(argv[++i], n, 1, 1024)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "-b" && i + 1 < argc) {
+            if (!parse_number(argv[++i], b, 1, 65536)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "-r" && i + 1 < argc) {
+            if (!parse_number(argv[++i], r, 1, 65536)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "--parse") {
+            return bench_parse(is, os, es);
+        } else if (arg == "--engines" && i + 1 < argc) {
+            names.clear();
+            std::string_view value(argv[++i]);
+            for (size_t b = 0, e; b <= value.size(); b = e + 1) {
+                e = std::min(value.find(',', b), value.size());
+                names.emplace_back(value.substr(b, e - b));
+            }
+        } else {
+            return usage();
+        }
+    }
+
+    const size_t num_hash_values = b * r;
+    std::vector<engine_stat> stats(names.size());
+    for (size_t k = 0; k < names.size(); ++k) {
+        // An engine name may be followed by "+FEATURE" (e.g., "oph+rolling").
+        const std::string_view name(names[k]);
+        const size_t plus = name.find('+');
+        const int engine = engine_from_name(name.substr(0, plus));
+        if (engine < 0) {
+            es << "ERROR: unknown engine: " << names[k] << std::endl;
+            return 1;
+        }
+        if (plus != std::string_view::npos) {
+            stats[k].feature = feature_from_name(name.substr(plus + 1));
+            if (stats[k].feature < 0 || (engine != ENGINE_PERMUTE && engine != ENGINE_OPH)) {
+                es << "ERROR: unknown feature for the engine: " << names[k] << std::endl;
+                return 1;
+            }
+        }
+        stats[k].se.init(engine, num_hash_values, seed, resolve_kernel(KERNEL_AUTO));
+    }
+
+    std::vector<const char *> cs_text, cs_variant, cs_prev;
+    std::vector<uint32_t> cps;
+    std::vector<uint64_t> xs_text, xs_variant;
+    std::string prev_text;
+    std::vector<uint32_t> xv(num_hash_values), yv(num_hash_values);
+    uint32_t *x = xv.data(), *y = yv.data();
+    double truth_near = 0., truth_far = 0.;
+    for (;;) {
+        std::string line;
+        std::getline(is, line);
+        if (is.eof()) {
+            break;
+        }
+        std::string text = json::parse(line)["text"];
+
+        // A near duplicate: the text without its last 10% of letters.
+        std::string variant = text;
+        const size_t length = utf8::distance(text.begin(), text.end());
+        auto it = text.begin();
+        utf8::advance(it, length - length / 10, text.end());
+        variant.assign(text.begin(), it);
+
+        // The time for extracting n-grams is charged to the engines.
+        auto begin = std::chrono::steady_clock::now();
+        const ngram_view fs = features(text, cs_text, n);
+        const ngram_view gs = features(variant, cs_variant, n);
+        auto end = std::chrono::steady_clock::now();
+        const double seconds_ngram = std::chrono::duration<double>(end - begin).count();
+        const ngram_view prev = ngram(prev_text, n, cs_prev);
+        const double j_near = jaccard(fs, gs);
+        const double j_far = num_docs ? jaccard(prev, fs) : 0.;
+        truth_near += j_near;
+        truth_far += j_far;
+
+        for (auto& st : stats) {
+            begin = std::chrono::steady_clock::now();
+            if (st.feature == FEATURE_ROLLING) {
+                // The text is "EMPTY" already when it is too short.
+                decode(text, cps);
+                rolling_hashes(cps, n, xs_text);
+                st.se.compute(xs_text.data(), xs_text.size(), x);
+                decode(variant, cps);
+                rolling_hashes(cps, n, xs_variant);
+                st.se.compute(xs_variant.data(), xs_variant.size(), y);
+            } else {
+                st.se.compute(fs, x);
+                st.se.compute(gs, y);
+            }
+            end = std::chrono::steady_clock::now();
+            st.seconds += std::chrono::duration<double>(end - begin).count();
+            st.seconds += (st.feature == FEATURE_ROLLING) ? 0. : seconds_ngram;
+            st.num_signatures += 2;
+
+            // The number of calls to byte-sequence hash functions.
+            const size_t calls = fs.size() + gs.size();
+            switch (st.se.engine) {
+            case ENGINE_MURMUR32:
+                st.num_hash_calls += calls * num_hash_values;
+                break;
+            case ENGINE_MURMUR128:
+                st.num_hash_calls += calls * num_hash_values / 4;
+                break;
+            default:
+                st.num_hash_calls += (st.feature == FEATURE_ROLLING) ? 0 : calls;
+                break;
+            }
+
+            bool hit;
+            st.error_near += std::fabs(estimate(x, y, b, r, hit) - j_near);
+            st.hits_near += hit;
+            if (num_docs) {
+                st.error_far += std::fabs(estimate(st.prev.data(), x, b, r, hit) - j_far);
+                st.hits_far += hit;
+            }
+            st.prev.assign(x, x + num_hash_values);
+        }
+        prev_text.swap(text);
+        ++num_docs;
+    }
+
+    // Report the statistics of each engine in JSON.
+    const size_t num_far = num_docs ? num_docs - 1 : 0;
+    for (size_t k = 0; k < stats.size(); ++k) {
+        const auto& st = stats[k];
+        os << '{' <<
+            kv("engine", names[k]) << ", " <<
+            kv("num_docs", num_docs) << ", " <<
+            kv("seconds", st.seconds) << ", " <<
+            kv("signatures_per_sec", st.num_signatures / st.seconds) << ", " <<
+            kv("num_hash_calls", st.num_hash_calls) << ", " <<
+            kv("jaccard_near", truth_near / num_docs) << ", " <<
+            kv("mae_near", st.error_near / num_docs) << ", " <<
+            kv("recall_near", st.hits_near / (double)num_docs) << ", " <<
+            kv("jaccard_far", truth_far / num_far) << ", " <<
+            kv("mae_far", st.error_far / num_far) << ", " <<
+            kv("candidate_rate_far", st.hits_far / (double)num_far) <<
+            '}' << std::endl;
+    }
+
+    return 0;
+}
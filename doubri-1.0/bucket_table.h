@@ -0,0 +1,257 @@
+/*
+    Open-addressing hash table of buckets.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    A set of buckets (bucket_type, e.g., bucket_t or fingerprint64_t) with
+    open addressing in the manner of Swiss tables. The buckets are appended
+    to an arena of fixed-size blocks (never moved), and the table stores a
+    7-bit fingerprint (control byte) and the 32-bit arena index of every
+    bucket. A lookup compares the control bytes of a group of 16 slots at
+    once (with SSE2 if available) and compares a bucket only when its
+    control byte matches, so that it touches a few cache lines regardless
+    of the size of the table. The set supports no deletion.
+*/
+template <typename bucket_type>
+class bucket_table
+{
+protected:
+    static constexpr size_t group_size = 16;
+    static constexpr size_t block_bits = 16;
+    static constexpr int8_t empty = -128;
+
+    std::vector<int8_t> m_ctrl;
+    std::vector<uint32_t> m_slots;
+    size_t m_group_mask = 0;
+    std::vector<std::unique_ptr<bucket_type[]> > m_blocks;
+    size_t m_size = 0;
+
+public:
+    bucket_table()
+    {
+        reset(16);
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    /*
+        The bucket of the arena index i (in the order of insertions).
+    */
+    const bucket_type& operator[](size_t i) const
+    {
+        return m_blocks[i >> block_bits][i & ((size_t(1) << block_bits) - 1)];
+    }
+
+    bool contains(const bucket_type& bucket) const
+    {
+        const uint64_t hv = hash(bucket);
+        size_t slot;
+        return find(bucket, hv, slot);
+    }
+
+    /*
+        Insert the bucket, and return false if it already exists.
+    */
+    bool insert(const bucket_type& bucket)
+    {
+        const uint64_t hv = hash(bucket);
+        size_t slot;
+        if (find(bucket, hv, slot)) {
+            return false;
+        }
+        if (m_size == UINT32_MAX) {
+            throw std::length_error("too many buckets in a table");
+        }
+
+        // Keep the load factor below 7/8.
+        if (8 * (m_size + 1) > 7 * m_ctrl.size()) {
+            grow();
+            find(bucket, hv, slot);
+        }
+
+        // Append the bucket to the arena.
+        const size_t i = m_size++;
+        if ((i >> block_bits) == m_blocks.size()) {
+            m_blocks.emplace_back(new bucket_type[size_t(1) << block_bits]);
+        }
+        m_blocks[i >> block_bits][i & ((size_t(1) << block_bits) - 1)] = bucket;
+        m_ctrl[slot] = h2(hv);
+        m_slots[slot] = static_cast<uint32_t>(i);
+        return true;
+    }
+
+    /*
+        The arena indices of the buckets in ascending order of the buckets
+        (the order of std::set<bucket_type>).
+    */
+    std::vector<uint32_t> sorted() const
+    {
+        std::vector<uint32_t> order(m_size);
+        for (size_t i = 0; i < m_size; ++i) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+            return std::less<bucket_type>()((*this)[x], (*this)[y]);
+        });
+        return order;
+    }
+
+    /*
+        Release the memory (the set becomes empty).
+    */
+    void clear()
+    {
+        m_blocks.clear();
+        m_size = 0;
+        reset(16);
+    }
+
+protected:
+    static std::string_view bytes_of(const std::string& bucket)
+    {
+        return bucket;
+    }
+
+    template <typename other_type>
+    static std::string_view bytes_of(const other_type& bucket)
+    {
+        return std::string_view(reinterpret_cast<const char*>(&bucket), sizeof(bucket));
+    }
+
+    /*
+        Mix all bytes of the bucket (MinHash values or fingerprints, which
+        are already random) into a 64-bit value.
+    */
+    static uint64_t hash(const bucket_type& bucket)
+    {
+        const std::string_view bytes = bytes_of(bucket);
+        uint64_t h = bytes.size();
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+            uint64_t w;
+            std::memcpy(&w, bytes.data() + i, sizeof(w));
+            h = (h ^ w) * 0x9e3779b97f4a7c15;
+        }
+        if (i < bytes.size()) {
+            uint64_t w = 0;
+            std::memcpy(&w, bytes.data() + i, bytes.size() - i);
+            h = (h ^ w) * 0x9e3779b97f4a7c15;
+        }
+        return h ^ (h >> 29);
+    }
+
+    /*
+        The control byte (7 bits, non-negative) of a hash value; the upper
+        bits choose the group.
+    */
+    static int8_t h2(uint64_t hv)
+    {
+        return static_cast<int8_t>(hv & 0x7F);
+    }
+
+    size_t h1(uint64_t hv) const
+    {
+        return (hv >> 7) & m_group_mask;
+    }
+
+    /*
+        The bit masks of the slots in a group whose control byte is value.
+    */
+    uint32_t match(size_t group, int8_t value) const
+    {
+        const int8_t *ctrl = &m_ctrl[group * group_size];
+#if defined(__SSE2__)
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(value))));
+#else
+        uint32_t mask = 0;
+        for (size_t k = 0; k < group_size; ++k) {
+            mask |= static_cast<uint32_t>(ctrl[k] == value) << k;
+        }
+        return mask;
+#endif
+    }
+
+    /*
+        Find the bucket with its hash value. Return true with its slot if
+        it exists; otherwise, return false with the empty slot for it.
+    */
+    bool find(const bucket_type& bucket, uint64_t hv, size_t& slot) const
+    {
+        const int8_t tag = h2(hv);
+        for (size_t group = h1(hv); ; group = (group + 1) & m_group_mask) {
+            for (uint32_t mask = match(group, tag); mask; mask &= mask - 1) {
+                const size_t s = group * group_size + __builtin_ctz(mask);
+                if ((*this)[m_slots[s]] == bucket) {
+                    slot = s;
+                    return true;
+                }
+            }
+            const uint32_t vacant = match(group, empty);
+            if (vacant) {
+                slot = group * group_size + __builtin_ctz(vacant);
+                return false;
+            }
+        }
+    }
+
+    void reset(size_t num_groups)
+    {
+        m_ctrl.assign(num_groups * group_size, empty);
+        m_slots.assign(num_groups * group_size, 0);
+        m_group_mask = num_groups - 1;
+    }
+
+    /*
+        Double the table and put the buckets of the arena into it.
+    */
+    void grow()
+    {
+        reset(2 * (m_group_mask + 1));
+        for (size_t i = 0; i < m_size; ++i) {
+            const uint64_t hv = hash((*this)[i]);
+            size_t slot;
+            find((*this)[i], hv, slot);
+            m_ctrl[slot] = h2(hv);
+            m_slots[slot] = static_cast<uint32_t>(i);
+        }
+    }
+};
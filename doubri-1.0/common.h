@@ -25,17 +25,49 @@ SOFTWARE.
 #pragma once
 
 #include <array>
+#include <charconv>
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <string_view>
 
+// The default parameters: n-grams of 5 letters, 40 buckets of 20 hash
+// values. The tools take other values from the command line (minhash) or
+// the header of a MinHash file (see hashfile.h).
+#define NGRAM_SIZE 5
 #define BYTE_PER_HASH 4
 #define BUCKET_SIZE 20
 #define BYTE_PER_BUCKET (BYTE_PER_HASH * BUCKET_SIZE)
 #define NUM_BUCKETS 40
 #define BYTE_PER_RECORD (BYTE_PER_BUCKET * NUM_BUCKETS)
 
-typedef std::array<uint8_t, BYTE_PER_BUCKET> bucket_t;
+// A bucket of R hash values.
+template <size_t R>
+using bucket_of = std::array<uint8_t, BYTE_PER_HASH * R>;
+
+typedef bucket_of<BUCKET_SIZE> bucket_t;
+
+// Fingerprints of buckets (see hashfile.h).
+typedef uint64_t fingerprint64_t;
+typedef std::array<uint64_t, 2> fingerprint128_t;
+
+/*
+    Parse a decimal number of the command line into value. Return false
+    (leaving value unchanged) for an empty string, other characters than
+    digits, or a number out of [min_value, max_value].
+*/
+template <typename T>
+inline bool parse_number(std::string_view str, T& value, uint64_t min_value, uint64_t max_value)
+{
+    uint64_t v = 0;
+    const char *end = str.data() + str.size();
+    auto [p, ec] = std::from_chars(str.data(), end, v);
+    if (str.empty() || ec != std::errc() || p != end || v < min_value || max_value < v) {
+        return false;
+    }
+    value = static_cast<T>(v);
+    return true;
+}
 
 struct kv {
     std::string _key;
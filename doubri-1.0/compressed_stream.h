@@ -0,0 +1,478 @@
+/*
+    Line reader and writer of (possibly) compressed text streams.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "bounded_queue.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+    Formats of text streams.
+*/
+enum stream_format {
+    FORMAT_PLAIN = 0,
+    FORMAT_GZIP = 1,
+    FORMAT_ZSTD = 2,
+};
+
+inline int format_from_name(std::string_view name)
+{
+    if (name == "plain") {
+        return FORMAT_PLAIN;
+    } else if (name == "gzip") {
+        return FORMAT_GZIP;
+    } else if (name == "zstd") {
+        return FORMAT_ZSTD;
+    }
+    return -1;
+}
+
+inline const char *format_name(int format)
+{
+    switch (format) {
+    case FORMAT_PLAIN:
+        return "plain";
+    case FORMAT_GZIP:
+        return "gzip";
+    case FORMAT_ZSTD:
+        return "zstd";
+    default:
+        return "unknown";
+    }
+}
+
+/*
+    Check whether this build can read and write the format.
+*/
+inline bool format_supported(int format)
+{
+    switch (format) {
+    case FORMAT_PLAIN:
+        return true;
+#ifdef HAVE_ZLIB
+    case FORMAT_GZIP:
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    case FORMAT_ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/*
+    Detect the format from the magic number at the beginning of a stream.
+*/
+inline int detect_format(const std::string& head)
+{
+    if (head.size() >= 2 && head.compare(0, 2, "\x1f\x8b") == 0) {
+        return FORMAT_GZIP;
+    } else if (head.size() >= 4 && head.compare(0, 4, "\x28\xb5\x2f\xfd") == 0) {
+        return FORMAT_ZSTD;
+    }
+    return FORMAT_PLAIN;
+}
+
+/*
+    A line reader of a text stream compressed by gzip, zstd, or nothing.
+
+    The format is detected from the magic number. A compressed stream is
+    decompressed by a dedicated thread, which passes blocks of text to the
+    reader through a bounded queue so that the decompression overlaps with
+    the processing of lines.
+
+    Like std::getline() followed by a check of eof(), getline() ignores the
+    last line when it does not end with a newline.
+*/
+class line_reader
+{
+protected:
+    std::istream& m_is;
+    size_t m_block_size;
+    int m_format;
+    std::string m_head;
+    std::string m_error;
+    std::string m_block;
+    size_t m_pos;
+    std::string m_line;
+    bounded_queue<std::string> m_blocks;
+    std::thread m_thread;
+
+public:
+    // getline() returns views that are invalidated by the next call.
+    static const bool stable_lines = false;
+
+    line_reader(std::istream& is, size_t block_size = 1 << 20)
+        : m_is(is), m_block_size(block_size), m_format(FORMAT_PLAIN), m_pos(0), m_blocks(4)
+    {
+        // Read the first block to detect the format.
+        read_raw(m_head);
+        m_format = detect_format(m_head);
+        if (m_format == FORMAT_PLAIN) {
+            m_block.swap(m_head);
+        } else if (!format_supported(m_format)) {
+            m_error = std::string("this build cannot read ") + format_name(m_format) + " streams";
+        } else {
+            m_thread = std::thread([this] { decompress(); });
+        }
+    }
+
+    virtual ~line_reader()
+    {
+        m_blocks.abort();
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    int format() const
+    {
+        return m_format;
+    }
+
+    /*
+        The error message when the stream is broken (empty when no error).
+        Check this after getline() returns false.
+    */
+    const std::string& error() const
+    {
+        return m_error;
+    }
+
+    /*
+        Read a line as a view of the current block, or of an internal buffer
+        when the line spans blocks. The view is valid until the next call.
+    */
+    bool getline(std::string_view& line)
+    {
+        m_line.clear();
+        for (;;) {
+            const char *begin = m_block.data() + m_pos;
+            const size_t size = m_block.size() - m_pos;
+            const char *p = static_cast<const char*>(std::memchr(begin, '\n', size));
+            if (p != nullptr) {
+                m_pos += (p - begin) + 1;
+                if (m_line.empty()) {
+                    line = std::string_view(begin, p - begin);
+                } else {
+                    m_line.append(begin, p);
+                    line = m_line;
+                }
+                return true;
+            }
+            m_line.append(begin, size);
+            if (!next_block()) {
+                return false;
+            }
+        }
+    }
+
+protected:
+    size_t read_raw(std::string& buffer)
+    {
+        buffer.resize(m_block_size);
+        m_is.read(&buffer[0], m_block_size);
+        buffer.resize(m_is.gcount());
+        return buffer.size();
+    }
+
+    bool next_block()
+    {
+        m_pos = 0;
+        m_block.clear();
+        if (m_format == FORMAT_PLAIN) {
+            return read_raw(m_block) > 0;
+        } else if (!m_thread.joinable()) {
+            // This build does not support the format.
+            return false;
+        } else {
+            // The decompressor sets m_error before closing the queue.
+            return m_blocks.pop(m_block);
+        }
+    }
+
+    void decompress()
+    {
+        switch (m_format) {
+#ifdef HAVE_ZLIB
+        case FORMAT_GZIP:
+            inflate_gzip();
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case FORMAT_ZSTD:
+            decompress_zstd();
+            break;
+#endif
+        default:
+            break;
+        }
+        m_blocks.close();
+    }
+
+#ifdef HAVE_ZLIB
+    void inflate_gzip()
+    {
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+            m_error = "failed to initialize zlib";
+            return;
+        }
+
+        std::string input;
+        input.swap(m_head);
+        zs.next_in = reinterpret_cast<Bytef*>(&input[0]);
+        zs.avail_in = input.size();
+
+        bool ended = false;
+        bool full = false;
+        for (;;) {
+            // Read the compressed stream unless inflate() has more output.
+            if (zs.avail_in == 0 && !full) {
+                if (read_raw(input) == 0) {
+                    break;
+                }
+                zs.next_in = reinterpret_cast<Bytef*>(&input[0]);
+                zs.avail_in = input.size();
+            }
+
+            // A concatenation of gzip members is also a gzip stream.
+            if (ended) {
+                inflateReset(&zs);
+                ended = false;
+            }
+
+            std::string output(m_block_size, '\0');
+            zs.next_out = reinterpret_cast<Bytef*>(&output[0]);
+            zs.avail_out = output.size();
+            const int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                m_error = std::string("broken gzip stream: ") + (zs.msg ? zs.msg : "unknown error");
+                break;
+            }
+            ended = (ret == Z_STREAM_END);
+            full = (!ended && zs.avail_out == 0);
+            output.resize(output.size() - zs.avail_out);
+            if (!output.empty() && !m_blocks.push(std::move(output))) {
+                break;
+            }
+        }
+
+        if (m_error.empty() && !ended) {
+            m_error = "premature end of the gzip stream";
+        }
+        inflateEnd(&zs);
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    void decompress_zstd()
+    {
+        ZSTD_DStream *ds = ZSTD_createDStream();
+        ZSTD_initDStream(ds);
+
+        std::string input;
+        input.swap(m_head);
+        ZSTD_inBuffer in{input.data(), input.size(), 0};
+
+        size_t ret = 0;
+        bool full = false;
+        for (;;) {
+            // Read the compressed stream unless the decoder has more output.
+            if (in.pos == in.size && !full) {
+                if (read_raw(input) == 0) {
+                    break;
+                }
+                in = ZSTD_inBuffer{input.data(), input.size(), 0};
+            }
+
+            std::string output(m_block_size, '\0');
+            ZSTD_outBuffer out{&output[0], output.size(), 0};
+            ret = ZSTD_decompressStream(ds, &out, &in);
+            if (ZSTD_isError(ret)) {
+                m_error = std::string("broken zstd stream: ") + ZSTD_getErrorName(ret);
+                break;
+            }
+            full = (out.pos == out.size);
+            output.resize(out.pos);
+            if (!output.empty() && !m_blocks.push(std::move(output))) {
+                break;
+            }
+        }
+
+        // A frame is complete when ZSTD_decompressStream() returns zero.
+        if (m_error.empty() && ret != 0) {
+            m_error = "premature end of the zstd stream";
+        }
+        ZSTD_freeDStream(ds);
+    }
+#endif
+};
+
+/*
+    A writer of a text stream compressed by gzip, zstd, or nothing.
+    Call finish() to write the end of the compressed stream.
+*/
+class compressed_writer
+{
+protected:
+    std::ostream& m_os;
+    int m_format;
+    std::string m_buffer;
+#ifdef HAVE_ZLIB
+    z_stream m_zs;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CStream *m_cs = nullptr;
+#endif
+
+public:
+    /*
+        Make sure that format_supported(format) is true beforehand.
+    */
+    compressed_writer(std::ostream& os, int format, size_t buffer_size = 1 << 18)
+        : m_os(os), m_format(format), m_buffer(buffer_size, '\0')
+    {
+#ifdef HAVE_ZLIB
+        std::memset(&m_zs, 0, sizeof(m_zs));
+        if (m_format == FORMAT_GZIP) {
+            deflateInit2(&m_zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (m_format == FORMAT_ZSTD) {
+            m_cs = ZSTD_createCStream();
+            ZSTD_initCStream(m_cs, 3);
+        }
+#endif
+    }
+
+    virtual ~compressed_writer()
+    {
+#ifdef HAVE_ZLIB
+        if (m_format == FORMAT_GZIP) {
+            deflateEnd(&m_zs);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (m_cs != nullptr) {
+            ZSTD_freeCStream(m_cs);
+        }
+#endif
+    }
+
+    bool write(const char *data, size_t size)
+    {
+        switch (m_format) {
+#ifdef HAVE_ZLIB
+        case FORMAT_GZIP:
+            return deflate_gzip(data, size, Z_NO_FLUSH);
+#endif
+#ifdef HAVE_ZSTD
+        case FORMAT_ZSTD:
+            return compress_zstd(data, size, ZSTD_e_continue);
+#endif
+        default:
+            m_os.write(data, size);
+            return !m_os.fail();
+        }
+    }
+
+    bool write(std::string_view str)
+    {
+        return write(str.data(), str.size());
+    }
+
+    bool finish()
+    {
+        switch (m_format) {
+#ifdef HAVE_ZLIB
+        case FORMAT_GZIP:
+            return deflate_gzip(nullptr, 0, Z_FINISH) && m_os.flush();
+#endif
+#ifdef HAVE_ZSTD
+        case FORMAT_ZSTD:
+            return compress_zstd(nullptr, 0, ZSTD_e_end) && m_os.flush();
+#endif
+        default:
+            return !m_os.flush().fail();
+        }
+    }
+
+protected:
+#ifdef HAVE_ZLIB
+    bool deflate_gzip(const char *data, size_t size, int flush)
+    {
+        m_zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        m_zs.avail_in = size;
+        for (;;) {
+            m_zs.next_out = reinterpret_cast<Bytef*>(&m_buffer[0]);
+            m_zs.avail_out = m_buffer.size();
+            const int ret = deflate(&m_zs, flush);
+            if (ret == Z_STREAM_ERROR) {
+                return false;
+            }
+            m_os.write(m_buffer.data(), m_buffer.size() - m_zs.avail_out);
+            if (flush == Z_FINISH ? ret == Z_STREAM_END : m_zs.avail_out != 0) {
+                break;
+            }
+        }
+        return !m_os.fail();
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    bool compress_zstd(const char *data, size_t size, ZSTD_EndDirective mode)
+    {
+        ZSTD_inBuffer in{data, size, 0};
+        for (;;) {
+            ZSTD_outBuffer out{&m_buffer[0], m_buffer.size(), 0};
+            const size_t remaining = ZSTD_compressStream2(m_cs, &out, &in, mode);
+            if (ZSTD_isError(remaining)) {
+                return false;
+            }
+            m_os.write(m_buffer.data(), out.pos);
+            if (mode == ZSTD_e_end ? remaining == 0 : in.pos == in.size) {
+                break;
+            }
+        }
+        return !m_os.fail();
+    }
+#endif
+};
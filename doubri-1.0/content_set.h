@@ -0,0 +1,160 @@
+/*
+    A set of content fingerprints of documents for exact duplicates.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "common.h"
+
+/*
+    A content fingerprint is the 128-bit MurmurHash3_x64_128 of the text of
+    a document. doubri-minhash stores the fingerprints of the records in
+    MINHASH_FILE.content (16 bytes per record without a header), and
+    doubri-self stores the fingerprints of a group in INDEX_FILE.content.
+*/
+#define CONTENT_SUFFIX ".content"
+
+/*
+    A hash set of content fingerprints with open addressing (linear
+    probing). A fingerprint is already a hash value, so its first word
+    locates the slot. The all-zero fingerprint marks an empty slot and is
+    kept in a flag instead.
+*/
+class content_set
+{
+protected:
+    std::vector<fingerprint128_t> m_slots;
+    size_t m_mask = 0;
+    size_t m_size = 0;
+    bool m_has_zero = false;
+
+public:
+    content_set()
+    {
+        m_slots.resize(1024);
+        m_mask = m_slots.size() - 1;
+    }
+
+    size_t size() const
+    {
+        return m_size + (m_has_zero ? 1 : 0);
+    }
+
+    bool contains(const fingerprint128_t& fp) const
+    {
+        if (is_zero(fp)) {
+            return m_has_zero;
+        }
+        for (size_t i = fp[0] & m_mask; ; i = (i + 1) & m_mask) {
+            if (m_slots[i] == fp) {
+                return true;
+            } else if (is_zero(m_slots[i])) {
+                return false;
+            }
+        }
+    }
+
+    /*
+        Insert the fingerprint, and return false if it already exists.
+    */
+    bool insert(const fingerprint128_t& fp)
+    {
+        if (is_zero(fp)) {
+            const bool inserted = !m_has_zero;
+            m_has_zero = true;
+            return inserted;
+        }
+        // Keep the load factor below 1/2.
+        if (2 * (m_size + 1) > m_slots.size()) {
+            grow();
+        }
+        for (size_t i = fp[0] & m_mask; ; i = (i + 1) & m_mask) {
+            if (m_slots[i] == fp) {
+                return false;
+            } else if (is_zero(m_slots[i])) {
+                m_slots[i] = fp;
+                ++m_size;
+                return true;
+            }
+        }
+    }
+
+    /*
+        Write all fingerprints (in no particular order).
+    */
+    void write(std::ostream& os) const
+    {
+        const fingerprint128_t zero{};
+        if (m_has_zero) {
+            os.write(reinterpret_cast<const char*>(zero.data()), sizeof(zero));
+        }
+        for (const auto& fp : m_slots) {
+            if (!is_zero(fp)) {
+                os.write(reinterpret_cast<const char*>(fp.data()), sizeof(fp));
+            }
+        }
+    }
+
+protected:
+    static bool is_zero(const fingerprint128_t& fp)
+    {
+        return (fp[0] | fp[1]) == 0;
+    }
+
+    void grow()
+    {
+        std::vector<fingerprint128_t> slots(m_slots.size() * 2);
+        slots.swap(m_slots);
+        m_mask = m_slots.size() - 1;
+        m_size = 0;
+        for (const auto& fp : slots) {
+            if (!is_zero(fp)) {
+                insert(fp);
+            }
+        }
+    }
+};
+
+/*
+    Read content fingerprints from the file. Return false if the file does
+    not exist or its size is not a multiple of 16 bytes.
+*/
+inline bool read_contents(const std::string& filename, std::vector<fingerprint128_t>& fps)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    if (ifs.fail()) {
+        return false;
+    }
+    ifs.seekg(0, std::ios::end);
+    const size_t size = static_cast<size_t>(ifs.tellg());
+    ifs.seekg(0, std::ios::beg);
+    if (size % sizeof(fingerprint128_t) != 0) {
+        return false;
+    }
+    fps.resize(size / sizeof(fingerprint128_t));
+    ifs.read(reinterpret_cast<char*>(fps.data()), size);
+    return !ifs.fail();
+}
@@ -29,18 +29,30 @@ SOFTWARE.
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <set>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <vector>
 #include <BS_thread_pool.hpp>
-#include "common.h"
+#include "content_set.h"
+#include "drop_log.h"
+#include "flag_store.h"
+#include "hashfile.h"
 
+/*
+    A sorted array of buckets of byte_per_bucket bytes: the hash values
+    (e.g., bucket_t) or their fingerprints (fingerprint64_t or
+    fingerprint128_t).
+*/
+template <typename bucket_type>
 class BucketSet
 {
 protected:
     size_t m_num;
-    bucket_t *m_buffer;
+    bucket_type *m_buffer;
     
 public:
     BucketSet() : m_num(0), m_buffer(NULL)
@@ -52,7 +64,7 @@ public:
         release();
     }
 
-    bool load(const std::string& filename)
+    bool load(const std::string& filename, uint32_t byte_per_bucket)
     {
         // Open the file.
         std::ifstream ifs(filename.c_str(), std::ios::binary);
@@ -67,14 +79,14 @@ public:
         ifs.seekg(0, std::ios::end);
         auto size = ifs.tellg();
         ifs.seekg(0, std::ios::beg);
-        assert(size % BYTE_PER_BUCKET == 0);
+        assert(size % byte_per_bucket == 0);
 
         // Read the index.
-        m_num = size / BYTE_PER_BUCKET;
-        m_buffer = new bucket_t[m_num];
+        m_num = size / byte_per_bucket;
+        m_buffer = new bucket_type[m_num];
         for (size_t i = 0; i < m_num; ++i) {
-            bucket_t& bucket = m_buffer[i];
-            ifs.read(reinterpret_cast<char*>(bucket.data()), bucket.size());
+            bucket_type& bucket = m_buffer[i];
+            ifs.read(bucket_data(bucket, byte_per_bucket), byte_per_bucket);
             if (ifs.fail()) {
                 return false;
             }
@@ -92,115 +104,128 @@ public:
         }
     }
 
-    bool exist(const bucket_t& query) const
+    bool exist(const bucket_type& query) const
     {
         return std::binary_search(m_buffer, m_buffer + m_num, query);
     }
 };
 
-void dedup(std::string hash_filename, const BucketSet* bs)
+/*
+    Deduplicate the records in the hash file against the index. A record
+    whose content fingerprint is in contents is an exact duplicate of a
+    record in the index group, and is dropped without reading its buckets.
+
+    With a drop_log name, the ids of the dropped records are written to the
+    drop log of the hash file, leaving the flag file untouched.
+*/
+template <typename bucket_type>
+void dedup(std::string hash_filename, const BucketSet<bucket_type>* bs, const content_set* contents, const hash_header* index_header, std::string drop_log)
 {
     size_t num_total = 0;
     size_t num_skips = 0;
     size_t num_drops = 0;
+    size_t num_exact_drops = 0;
     BS::synced_stream sos(std::cout);
     BS::synced_stream ses(std::cerr);
 
     // Obtain the name for the flag file.
     std::string flag_filename(hash_filename);
-    flag_filename += ".f";
+    flag_filename += FLAG_SUFFIX;
     
-    // Open the hash file for reading (binary).
-    std::ifstream ifs(hash_filename, std::ios::binary);
-    if (ifs.fail()) {
+    // Map the hash file and read its header.
+    hash_reader reader;
+    if (!reader.open(hash_filename)) {
         std::stringstream ss;
-        ss << "ERROR: could not open the hash file: " << hash_filename;
+        ss << "ERROR: " << reader.error();
         ses.println(ss.str());
         return;
     }
+    const hash_header& header = reader.header();
 
-    // Read the header and check consistencies.
-    char magic[8]{};
-    ifs.read(magic, 7);
-    if (std::strcmp(magic, "MinHash") != 0) {
+    // Refuse to compare MinHash values computed by different settings.
+    if (!header.compatible(*index_header)) {
         std::stringstream ss;
-        ss << "ERROR: unrecognized header: " << magic;
+        ss << "ERROR: incompatible MinHash file: " << hash_filename << " (" << header.describe() << ") with the index (" << index_header->describe() << ")";
         ses.println(ss.str());
         return;
     }
 
-    // Check the consistency of size_t;
-    uint8_t byte_per_hash;
-    ifs.read(reinterpret_cast<char*>(&byte_per_hash), 1);
-    if (byte_per_hash != 4) {
+    // Read the flags (written back to the flag file at the end).
+    flag_store flags;
+    if (!flags.load(flag_filename)) {
         std::stringstream ss;
-        ss << "ERROR: Hash size is not 4 bytes but " << byte_per_hash;
+        ss << "ERROR: " << flags.error();
         ses.println(ss.str());
         return;
     }
 
-    // Open the flag file for reading/writing.
-    std::fstream fs(flag_filename, std::ios::in | std::ios::out);
-    if (fs.fail()) {
+    // Read the content fingerprints of the records (if any).
+    std::vector<fingerprint128_t> fps;
+    const bool has_contents = contents->size() > 0 && read_contents(hash_filename + CONTENT_SUFFIX, fps);
+    if (has_contents && fps.size() != header.num_records) {
         std::stringstream ss;
-        ss << "ERROR: could not open the flag file: " << flag_filename;
+        ss << "ERROR: the number of content fingerprints is not " << header.num_records << " but " << fps.size() << ": " << hash_filename << CONTENT_SUFFIX;
         ses.println(ss.str());
         return;
     }
 
     // For each record in the flag file.
-    for (size_t lineno = 0; ; ++lineno) {
-        // Read a flag.
-        char flag = fs.get();
-        if (fs.eof()) {
-            break;
-        }
-
+    drop_log_writer log(header.num_records);
+    for (size_t lineno = 0; lineno < flags.size(); ++lineno) {
         ++num_total;
 
         // Do nothing if the record has already been removed.
-        if (flag == '0') {
+        if (!flags.active(lineno)) {
             ++num_skips;
             continue;
-        } else if (flag != '1') {
-            std::stringstream ss;
-            ss << "ERROR: a flag must be either '0' or '1': " << flag;
-            ses.println(ss.str());
-            return;
         }
 
-        // Seek to the hash values of the #lineno.
-        std::streampos pos = 24 + BYTE_PER_RECORD * lineno;
-        ifs.seekg(pos);
-        if (ifs.fail()) {
+        // Drop an exact duplicate without reading the hash values.
+        if (has_contents && lineno < fps.size() && contents->contains(fps[lineno])) {
+            flags.drop(lineno);
+            log.append(lineno);
+            ++num_drops;
+            ++num_exact_drops;
+            continue;
+        }
+
+        // A record beyond the hash file is broken.
+        if (lineno >= header.num_records) {
             std::stringstream ss;
-            ss << "ERROR: failed to seek to a hash value: " << pos;
+            ss << "ERROR: failed to read the hash value";
             ses.println(ss.str());
             return;
         }
 
         // Check if any bucket is found in the indices.
-        for (size_t i = 0;i < NUM_BUCKETS; ++i) {
-            // Read the bucket.
-            bucket_t bucket;
-            ifs.read(reinterpret_cast<char*>(bucket.data()), bucket.size());
-            if (ifs.eof()) {
-                std::stringstream ss;
-                ss << "ERROR: failed to read the hash value";
-                ses.println(ss.str());
-                return;
-            }
-            
+        for (size_t i = 0;i < header.num_buckets; ++i) {
+            bucket_type bucket;
+            std::memcpy(bucket_data(bucket, header.byte_per_bucket), reader.bucket(lineno, i), header.byte_per_bucket);
             if (bs[i].exist(bucket)) {
                 // Drop this record.
-                fs.seekp(-1, std::ios_base::cur);
-                fs.put('0');
+                flags.drop(lineno);
+                log.append(lineno);
                 ++num_drops;
                 break;
             }
         }        
     }
 
+    // Write the flags back to the flag file (or the drop log).
+    if (!drop_log.empty()) {
+        if (!log.save(drop_log_filename(hash_filename, drop_log))) {
+            std::stringstream ss;
+            ss << "ERROR: " << log.error();
+            ses.println(ss.str());
+            return;
+        }
+    } else if (!flags.save()) {
+        std::stringstream ss;
+        ss << "ERROR: " << flags.error();
+        ses.println(ss.str());
+        return;
+    }
+
     // Report the stat to STDOUT.
     size_t num_active = num_total - num_skips - num_drops;
     auto pos = hash_filename.find_last_of('/');
@@ -218,27 +243,204 @@ void dedup(std::string hash_filename, const BucketSet* bs)
         kv("num_active", num_active) << ", " <<
         kv("num_skips", num_skips) << ", " <<
         kv("num_drops", num_drops) << ", " <<
+        kv("num_exact_drops", num_exact_drops) << ", " <<
         kv("active_rate", num_active / (double)num_total) << ", " <<
         kv("drop_rate", num_drops / (double)num_total) <<
         '}';
     sos.println(ss.str());
 }
 
-int main(int argc, char *argv[])
+/*
+    A hash file deduplicated bucket by bucket.
+*/
+struct column_target {
+    std::string hash_filename;
+    std::unique_ptr<hash_reader> reader;
+    flag_store flags;               // The flags of the records.
+    std::vector<uint8_t> drops;     // Whether each record is dropped.
+    size_t num_skips = 0;
+    size_t num_drops = 0;
+    size_t num_exact_drops = 0;
+};
+
+/*
+    Open the hash file and its flag file of the target, and drop exact
+    duplicates by the content fingerprints. Return false on an error.
+*/
+bool open_target(column_target& t, const content_set& contents, const hash_header& index_header, std::ostream& es)
 {
-    std::istream& is = std::cin;
-    std::stringstream os;
-    // std::stringstream es;
-    std::string index_filename(argv[1]);
-    
+    t.reader.reset(new hash_reader);
+    if (!t.reader->open(t.hash_filename)) {
+        es << "ERROR: " << t.reader->error() << std::endl;
+        return false;
+    }
+    const hash_header& header = t.reader->header();
+    if (!header.compatible(index_header)) {
+        es << "ERROR: incompatible MinHash file: " << t.hash_filename << " (" << header.describe() << ") with the index (" << index_header.describe() << ")" << std::endl;
+        return false;
+    }
+
+    // Read the flags.
+    if (!t.flags.load(t.hash_filename + FLAG_SUFFIX)) {
+        es << "ERROR: " << t.flags.error() << std::endl;
+        return false;
+    }
+    if (t.flags.size() != header.num_records) {
+        es << "ERROR: the number of flags is not " << header.num_records << ": " << t.hash_filename << FLAG_SUFFIX << std::endl;
+        return false;
+    }
+    t.drops.assign(t.flags.size(), 0);
+    t.num_skips = t.flags.size() - t.flags.count();
+
+    // Drop exact duplicates.
+    std::vector<fingerprint128_t> fps;
+    if (contents.size() > 0 && read_contents(t.hash_filename + CONTENT_SUFFIX, fps) && fps.size() == t.flags.size()) {
+        for (size_t i = 0; i < fps.size(); ++i) {
+            if (t.flags.active(i) && contents.contains(fps[i])) {
+                t.drops[i] = 1;
+                ++t.num_exact_drops;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+    Deduplicate the hash files bucket by bucket: load the index of the
+    bucket #j only, and scan the bucket #j of all records of the mapped
+    targets (contiguous per block in the column-major layout). A record is
+    dropped if any of its buckets is in the index, so the order of buckets
+    does not change the result, and the memory holds one index at a time.
+*/
+template <typename bucket_type>
+int run_by_bucket(const std::vector<std::string>& hash_filenames, const std::string& index_filename, const content_set& contents, const hash_header& index_header, const std::string& drop_log)
+{
+    std::ostream& os = std::cout;
+    std::ostream& es = std::cerr;
+    const size_t bpb = index_header.byte_per_bucket;
+
+    // Open the targets. A target with an error is skipped, and the other
+    // targets are processed before returning 1.
+    int ret = 0;
+    std::vector<column_target> targets;
+    for (const auto& hash_filename : hash_filenames) {
+        column_target t;
+        t.hash_filename = hash_filename;
+        if (open_target(t, contents, index_header, es)) {
+            targets.push_back(std::move(t));
+        } else {
+            ret = 1;
+        }
+    }
+
+    BS::thread_pool pool;
+    for (size_t j = 0; j < index_header.num_buckets; ++j) {
+        // Open the index of the bucket #j.
+        std::ostringstream oss;
+        oss << index_filename << '.'
+            << std::setw(5) << std::setfill('0') << j;
+        BucketSet<bucket_type> bs;
+        bs.load(oss.str(), bpb);
+
+        // Stream the bucket #j of the targets.
+        for (auto& t : targets) {
+            pool.push_task([&bs, &t, j, bpb] {
+                for (uint64_t i = 0; i < t.reader->num_records(); ++i) {
+                    if (t.flags.active(i) && !t.drops[i]) {
+                        bucket_type bucket;
+                        std::memcpy(bucket_data(bucket, bpb), t.reader->bucket(i, j), bpb);
+                        t.drops[i] = bs.exist(bucket);
+                    }
+                }
+            });
+        }
+        pool.wait_for_tasks();
+    }
+
+    // Write the flags (or the drop logs) and report the stats to STDOUT.
+    for (auto& t : targets) {
+        drop_log_writer log(t.flags.size());
+        for (size_t i = 0; i < t.flags.size(); ++i) {
+            if (t.drops[i]) {
+                t.flags.drop(i);
+                log.append(i);
+                ++t.num_drops;
+            }
+        }
+        if (!drop_log.empty()) {
+            if (!log.save(drop_log_filename(t.hash_filename, drop_log))) {
+                es << "ERROR: " << log.error() << std::endl;
+                ret = 1;
+                continue;
+            }
+        } else if (!t.flags.save()) {
+            es << "ERROR: " << t.flags.error() << std::endl;
+            ret = 1;
+            continue;
+        }
+
+        const size_t num_total = t.flags.size();
+        const size_t num_active = num_total - t.num_skips - t.num_drops;
+        auto pos = t.hash_filename.find_last_of('/');
+        pos = (pos == std::string::npos) ? 0 : pos + 1;
+        os << '{' <<
+            kv("target", std::string(t.hash_filename, pos)) << ", " <<
+            kv("num_total", num_total) << ", " <<
+            kv("num_active", num_active) << ", " <<
+            kv("num_skips", t.num_skips) << ", " <<
+            kv("num_drops", t.num_drops) << ", " <<
+            kv("num_exact_drops", t.num_exact_drops) << ", " <<
+            kv("active_rate", num_active / (double)num_total) << ", " <<
+            kv("drop_rate", t.num_drops / (double)num_total) <<
+            '}' << std::endl;
+    }
+    return ret;
+}
+
+/*
+    Deduplicate the hash files listed in the target files (argv[first:])
+    against the index of buckets of bucket_type.
+*/
+template <typename bucket_type>
+int run(int argc, char *argv[], int first, bool by_bucket, const std::string& drop_log, const std::string& index_filename, const hash_header& index_header)
+{
+    // Open the content fingerprints of the index (if any).
+    content_set contents;
+    {
+        std::vector<fingerprint128_t> fps;
+        if (read_contents(index_filename + CONTENT_SUFFIX, fps)) {
+            for (const auto& fp : fps) {
+                contents.insert(fp);
+            }
+        }
+    }
+
+    // Process the targets bucket by bucket.
+    if (by_bucket) {
+        std::vector<std::string> hash_filenames;
+        for (int i = first; i < argc; ++i) {
+            std::ifstream ifs(argv[i]);
+            if (ifs.fail()) {
+                std::cerr << "ERROR: failed to open a target file: " << argv[i] << std::endl;
+                return 1;
+            }
+            for (std::string line; std::getline(ifs, line); ) {
+                if (!line.empty()) {
+                    hash_filenames.push_back(line);
+                }
+            }
+        }
+        return run_by_bucket<bucket_type>(hash_filenames, index_filename, contents, index_header, drop_log);
+    }
+
     // Open the bucket indices.
-    BucketSet bs[NUM_BUCKETS];
-    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+    std::vector<BucketSet<bucket_type> > bs(index_header.num_buckets);
+    for (size_t i = 0; i < bs.size(); ++i) {
         // Open the index file.
         std::ostringstream oss;
         oss << index_filename << '.'
             << std::setw(5) << std::setfill('0') << i;
-        bs[i].load(oss.str());
+        bs[i].load(oss.str(), index_header.byte_per_bucket);
     }
 
     int total_tasks = 0;
@@ -248,9 +450,9 @@ int main(int argc, char *argv[])
     std::stringstream es;
     es << "DEBUG: Program started with " << argc << " arguments" << std::endl;
     es << argv[0] << " is the program name." << std::endl;
-    es << argv[1] << " is the index file." << std::endl;
+    es << argv[first - 1] << " is the index file." << std::endl;
 
-    for (int i = 2; i < argc; ++i) {
+    for (int i = first; i < argc; ++i) {
         std::stringstream es;
         std::ifstream ifs(argv[i]);
         es << "argv[" << i << "] = " << argv[i] << std::endl;
@@ -271,7 +473,7 @@ int main(int argc, char *argv[])
             }
             if (!line.empty()) {
                 es << "DEBUG: read line " << line << std::endl;
-                pool.push_task(dedup, line, bs);
+                pool.push_task(dedup<bucket_type>, line, bs.data(), &contents, &index_header, drop_log);
                 ++total_tasks;
             }
         }
@@ -297,3 +499,54 @@ int main(int argc, char *argv[])
 
     return 0;
 }
+
+int main(int argc, char *argv[])
+{
+    std::istream& is = std::cin;
+    std::stringstream os;
+    // std::stringstream es;
+
+    // Parse the options before the index file.
+    int first = 1;
+    bool by_bucket = false;
+    std::string drop_log;
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+        std::string_view arg(argv[first]);
+        if (arg == "--by-bucket") {
+            by_bucket = true;
+        } else if (arg == "--drop-log" && first + 1 < argc) {
+            drop_log = argv[++first];
+            if (drop_log.empty() || drop_log.find('/') != std::string::npos) {
+                std::cerr << "ERROR: invalid name of the drop log: " << drop_log << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "ERROR: unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (argc <= first) {
+        std::cerr << "USAGE: " << argv[0] << " [--by-bucket] [--drop-log NAME] INDEX_FILE GROUP-1 GROUP-2 ... GROUP-K" << std::endl;
+        return 1;
+    }
+    std::string index_filename(argv[first++]);
+
+    // Read the settings of the MinHash values in the index. An index
+    // without the header is built from the version-1 MinHash files.
+    hash_header index_header;
+    {
+        std::string header_filename = index_filename + ".header";
+        std::ifstream ifs(header_filename, std::ios::binary);
+        std::string message;
+        if (!ifs.fail() && !read_header(ifs, index_header, message)) {
+            std::cerr << "ERROR: " << message << ": " << header_filename << std::endl;
+            return 1;
+        }
+    }
+
+    // The index stores the buckets or their fingerprints (in a type of
+    // the fixed size for the common configurations).
+    return dispatch_bucket(index_header.byte_per_bucket, [&](auto bucket) {
+        return run<decltype(bucket)>(argc, argv, first, by_bucket, drop_log, index_filename, index_header);
+    });
+}
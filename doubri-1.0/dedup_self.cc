@@ -25,159 +25,251 @@ SOFTWARE.
 #include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <set>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <vector>
+#include <BS_thread_pool.hpp>
 
-#define BYTE_PER_HASH 4
-#define BUCKET_SIZE 20
-#define BYTE_PER_BUCKET (BYTE_PER_HASH * BUCKET_SIZE)
-#define NUM_BUCKETS 40
-#define BYTE_PER_RECORD (BYTE_PER_BUCKET * NUM_BUCKETS)
+#include "bucket_table.h"
+#include "content_set.h"
+#include "flag_store.h"
+#include "hashfile.h"
 
-typedef std::array<uint8_t, BYTE_PER_BUCKET> bucket_t;
-typedef std::set<bucket_t> BucketSet;
+/*
+    Deduplicate the records #first, ..., #first+n-1 one by one: a record is
+    dropped if any of its buckets is seen before, and its buckets are added
+    to bs otherwise. active[k] tells whether the record #first+k is to be
+    checked, and is cleared when the record is dropped.
+*/
+template <typename bucket_type>
+void dedup_records(const hash_reader& reader, uint64_t first, size_t n, uint32_t byte_per_bucket, std::vector<bucket_table<bucket_type> >& bs, std::vector<uint8_t>& active)
+{
+    std::vector<bucket_type> buckets(bs.size());
+    for (size_t k = 0; k < n; ++k) {
+        if (!active[k]) {
+            continue;
+        }
 
-struct kv {
-    std::string _key;
-    std::string _value;
+        // Check if any bucket is seen before.
+        for (size_t j = 0; j < bs.size(); ++j) {
+            std::memcpy(bucket_data(buckets[j], byte_per_bucket), reader.bucket(first + k, j), byte_per_bucket);
+            if (bs[j].contains(buckets[j])) {
+                active[k] = 0;
+                break;
+            }
+        }
 
-    kv(std::string_view key, std::string_view value)
-        : _key(key)
-    {
-        _value = "\"";
-        _value += value;
-        _value += "\"";
+        // Set the buckets.
+        if (active[k]) {
+            for (size_t j = 0; j < bs.size(); ++j) {
+                bs[j].insert(buckets[j]);
+            }
+        }
     }
-    kv(std::string_view key, size_t value)
-        : _key(key)
-    {
-        _value = std::to_string(value);
+}
+
+/*
+    Deduplicate the records #first, ..., #first+n-1 with the thread pool,
+    giving the same result as dedup_records():
+
+    1. For every bucket #j in parallel, probe the table bs[j] with the
+       bucket #j of the records, and group the records of the block that
+       share the bucket #j (by sorting them).
+    2. In the order of the records, keep a record unless one of its
+       buckets is in the tables or shared with a record kept before.
+    3. For every bucket #j in parallel, insert the buckets of the kept
+       records into bs[j].
+
+    The bucket #j of a record is copied from the mapped file only once.
+*/
+template <typename bucket_type>
+void dedup_block(const hash_reader& reader, uint64_t first, size_t n, uint32_t byte_per_bucket, std::vector<bucket_table<bucket_type> >& bs, std::vector<uint8_t>& active, BS::thread_pool& pool)
+{
+    const size_t num_buckets = bs.size();
+    std::vector<std::vector<bucket_type> > columns(num_buckets);
+    std::vector<uint8_t> hits(num_buckets * n);
+    std::vector<uint32_t> leaders(num_buckets * n);
+
+    // Probe the tables and group the records by their buckets.
+    for (size_t j = 0; j < num_buckets; ++j) {
+        pool.push_task([&, j] {
+            std::vector<bucket_type>& column = columns[j];
+            std::vector<uint32_t> order;
+            column.resize(n);
+            for (size_t k = 0; k < n; ++k) {
+                if (active[k]) {
+                    std::memcpy(bucket_data(column[k], byte_per_bucket), reader.bucket(first + k, j), byte_per_bucket);
+                    hits[j * n + k] = bs[j].contains(column[k]);
+                    order.push_back(static_cast<uint32_t>(k));
+                }
+            }
+
+            // The leader of a group is the first record with the bucket.
+            std::sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+                return column[x] < column[y] || (column[x] == column[y] && x < y);
+            });
+            for (size_t i = 0; i < order.size(); ++i) {
+                const bool head = i == 0 || !(column[order[i-1]] == column[order[i]]);
+                leaders[j * n + order[i]] = head ? order[i] : leaders[j * n + order[i-1]];
+            }
+        });
     }
-    kv(std::string_view key, double value)
-        : _key(key)
-    {
-        _value = std::to_string(value);
+    pool.wait_for_tasks();
+
+    // Resolve the records in order, marking the groups of the kept records.
+    std::vector<uint8_t> kept(num_buckets * n, 0);
+    for (size_t k = 0; k < n; ++k) {
+        if (!active[k]) {
+            continue;
+        }
+        for (size_t j = 0; j < num_buckets; ++j) {
+            if (hits[j * n + k] || kept[j * n + leaders[j * n + k]]) {
+                active[k] = 0;
+                break;
+            }
+        }
+        if (active[k]) {
+            for (size_t j = 0; j < num_buckets; ++j) {
+                kept[j * n + leaders[j * n + k]] = 1;
+            }
+        }
     }
-};
 
-template <typename CharT, typename Traits>
-decltype(auto) operator<<(std::basic_ostream<CharT, Traits>& os, kv rhs)
-{
-    os << '"' << rhs._key << '"' << ": " << rhs._value;
-    return os;
+    // Insert the buckets of the kept records.
+    for (size_t j = 0; j < num_buckets; ++j) {
+        pool.push_task([&, j] {
+            for (size_t k = 0; k < n; ++k) {
+                if (active[k]) {
+                    bs[j].insert(columns[j][k]);
+                }
+            }
+        });
+    }
+    pool.wait_for_tasks();
 }
 
-int dedup(const std::string& hash_filename, BucketSet* bs)
+/*
+    Deduplicate the records in the hash file against the buckets in bs.
+    A bucket (bucket_type) of byte_per_bucket bytes is either the hash
+    values (e.g., bucket_t) or their fingerprint (fingerprint64_t or
+    fingerprint128_t). The first file of the group fixes the number of
+    buckets.
+
+    When the content fingerprints of the records are available, a record
+    whose fingerprint is in contents is an exact duplicate of a record
+    checked before, and is dropped without reading its buckets. This gives
+    the same result because an exact duplicate shares all buckets with the
+    record or the one that caused the record to be dropped.
+
+    The records are checked block by block, by dedup_block() with the
+    thread pool (or dedup_records() without), which yield the same flags
+    and buckets.
+*/
+template <typename bucket_type>
+int dedup(const std::string& hash_filename, uint32_t byte_per_bucket, std::vector<bucket_table<bucket_type> >& bs, content_set& contents, hash_header& group, bool& has_group, BS::thread_pool *pool)
 {
     size_t num_total = 0;
     size_t num_skips = 0;
     size_t num_drops = 0;
+    size_t num_exact_drops = 0;
     std::ostream& os = std::cout;
     std::ostream& es = std::cerr;
 
     // Obtain the name for the flag file.
     std::string flag_filename(hash_filename);
-    flag_filename += ".f";
+    flag_filename += FLAG_SUFFIX;
 
-    // Open the hash file for reading (binary).
-    std::ifstream ifs(hash_filename, std::ios::binary);
-    if (ifs.fail()) {
-        es << "ERROR: could not open the hash file: " << hash_filename << std::endl;
+    // Map the hash file and read its header.
+    hash_reader reader;
+    if (!reader.open(hash_filename)) {
+        es << "ERROR: " << reader.error() << std::endl;
         return 1;
     }
+    reader.advise(MADV_SEQUENTIAL);
+    const hash_header& header = reader.header();
+    size_t num_records = header.num_records;
 
-    // Read the header and check consistencies.
-    char magic[8]{};
-    ifs.read(magic, 7);
-    if (std::strcmp(magic, "MinHash") != 0) {
-        es << "ERROR: unrecognized header: " << magic << std::endl;
+    // Refuse to mix MinHash values computed by different settings.
+    if (header.byte_per_bucket != byte_per_bucket) {
+        es << "ERROR: incompatible MinHash file: " << hash_filename << " (" << header.describe() << ") with buckets of " << byte_per_bucket << " bytes" << std::endl;
         return 1;
     }
-
-    // Check the consistency of size_t;
-    uint8_t byte_per_hash;
-    ifs.read(reinterpret_cast<char*>(&byte_per_hash), 1);
-    if (byte_per_hash != 4) {
-        es << "ERROR: Hash size is not 4 bytes but " << byte_per_hash << std::endl;
+    if (!has_group) {
+        group = header;
+        has_group = true;
+        bs.resize(group.num_buckets);
+    } else if (!header.compatible(group)) {
+        es << "ERROR: incompatible MinHash file: " << hash_filename << " (" << header.describe() << ") in the group (" << group.describe() << ")" << std::endl;
         return 1;
     }
 
-    // Read the number of records.
-    size_t num_records;
-    ifs.read(reinterpret_cast<char*>(&num_records), sizeof(num_records));
-
-    // Read the number of hash values per record.
-    size_t num_hash_values_per_record;
-    ifs.read(reinterpret_cast<char*>(&num_hash_values_per_record), sizeof(num_hash_values_per_record));
-    if (num_hash_values_per_record != BUCKET_SIZE * NUM_BUCKETS) {
-        es << "ERROR: Hash size is not 4 bytes but " << byte_per_hash << std::endl;
+    // Read the flags (written back to the flag file at the end).
+    flag_store flags;
+    if (!flags.load(flag_filename)) {
+        es << "ERROR: " << flags.error() << std::endl;
         return 1;
     }
-    
-    // Open the flag file for reading/writing.
-    std::fstream fs(flag_filename, std::ios::in | std::ios::out);
-    if (fs.fail()) {
-        es << "ERROR: could not open the flag file: " << flag_filename << std::endl;
+    if (flags.size() < num_records) {
+        es << "ERROR: premature end of the flag file: " << flag_filename << std::endl;
         return 1;
     }
 
-    // For each record in the flag file.
-    for (size_t lineno = 0; lineno < num_records; ++lineno) {
-        // Read a flag.
-        char flag = fs.get();
-        if (fs.eof()) {
-            es << "ERROR: premature end of the flag file" << std::endl;
-            return 1;
-        }
+    // Read the content fingerprints of the records (if any).
+    std::vector<fingerprint128_t> fps;
+    const bool has_contents = read_contents(hash_filename + CONTENT_SUFFIX, fps);
+    if (has_contents && fps.size() != num_records) {
+        es << "ERROR: the number of content fingerprints is not " << num_records << " but " << fps.size() << ": " << hash_filename << CONTENT_SUFFIX << std::endl;
+        return 1;
+    }
 
-        ++num_total;
+    // For each block of the records.
+    const uint64_t block_size = header.block_size ? header.block_size : 4096;
+    std::vector<uint8_t> active;
+    for (size_t lineno = 0; lineno < num_records; lineno += active.size()) {
+        const size_t n = std::min<uint64_t>(block_size, num_records - lineno);
 
-        // Do nothing if the record has already been removed.
-        bool skip = false;
-        if (flag == '0') {
-            skip = true;
-            ++num_skips;
-        } else if (flag != '1') {
-            es << "ERROR: a flag must be either '0' or '1': " << flag << std::endl;
-            return 1;
+        // Skip the removed records and drop exact duplicates without
+        // reading their hash values.
+        active.assign(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            ++num_total;
+            if (!flags.active(lineno + k)) {
+                ++num_skips;
+            } else if (has_contents && !contents.insert(fps[lineno + k])) {
+                flags.drop(lineno + k);
+                ++num_drops;
+                ++num_exact_drops;
+            } else {
+                active[k] = 1;
+            }
         }
 
-        // Read the hash values of the record.
-        bucket_t buckets[NUM_BUCKETS];
-        for (size_t i = 0;i < NUM_BUCKETS; ++i) {
-            ifs.read(reinterpret_cast<char*>(buckets[i].data()), buckets[i].size());
-            if (ifs.eof()) {
-                es << "ERROR: failed to read the hash value" << std::endl;
-                return 1;
-            }
-        }        
-        
-        // Check if the hash value is seen before.
-	bool drop = false;
-        if (!skip) {
-            for (size_t i = 0;i < NUM_BUCKETS; ++i) {
-                if (bs[i].find(buckets[i]) != bs[i].end()) {
-                    // Drop this record.
-                    fs.seekp(-1, std::ios_base::cur);
-                    fs.put('0');
-		    drop = true;
-                    ++num_drops;
-                    break;
-                }
+        // Check the buckets of the block, and update the flags.
+        if (pool != nullptr) {
+            dedup_block(reader, lineno, n, byte_per_bucket, bs, active, *pool);
+        } else {
+            dedup_records(reader, lineno, n, byte_per_bucket, bs, active);
+        }
+        for (size_t k = 0; k < n; ++k) {
+            if (flags.active(lineno + k) && !active[k]) {
+                flags.drop(lineno + k);
+                ++num_drops;
             }
-            // Set the buckets.
-            if (!drop) {
-	        for (size_t i = 0;i < NUM_BUCKETS; ++i) {
-                    bs[i].insert(buckets[i]);
-                }
-	    }
         }
+        reader.release(lineno + n);
+    }
+
+    // Write the flags back to the flag file.
+    if (!flags.save()) {
+        es << "ERROR: " << flags.error() << std::endl;
+        return 1;
     }
 
     // Report the stat to STDOUT.
@@ -196,6 +288,7 @@ int dedup(const std::string& hash_filename, BucketSet* bs)
         kv("num_active", num_active) << ", " <<
         kv("num_skips", num_skips) << ", " <<
         kv("num_drops", num_drops) << ", " <<
+        kv("num_exact_drops", num_exact_drops) << ", " <<
         kv("active_rate", num_active / (double)num_total) << ", " <<
         kv("drop_rate", num_drops / (double)num_total) <<
         '}' << std::endl;
@@ -203,27 +296,66 @@ int dedup(const std::string& hash_filename, BucketSet* bs)
     return 0;
 }
 
-int main(int argc, char *argv[])
+/*
+    Deduplicate the hash files and save the index of the buckets.
+*/
+template <typename bucket_type>
+int run(const std::vector<std::string>& hash_filenames, uint32_t byte_per_bucket, const std::string& index_filename, size_t num_threads)
 {
-    std::istream& is = std::cin;
-    std::ostream& os = std::cout;
     std::ostream& es = std::cerr;
-    std::string index_filename(argv[1]);
-    
-    std::set<bucket_t> bs[NUM_BUCKETS];
-    for (;;) {
-        // Read a source file.
-        std::string line;
-        std::getline(is, line);
-        if (is.eof()) {
-            break;
-        }
+    std::unique_ptr<BS::thread_pool> pool;
+    if (num_threads > 1) {
+        pool.reset(new BS::thread_pool(num_threads));
+    }
+
+    std::vector<bucket_table<bucket_type> > bs;
+    content_set contents;
+    hash_header group;
+    bool has_group = false;
+    size_t num_failures = 0;
+    for (const auto& hash_filename : hash_filenames) {
         // Run deduplication for the file.
-        dedup(line, bs);
+        if (dedup(hash_filename, byte_per_bucket, bs, contents, group, has_group, pool.get()) != 0) {
+            ++num_failures;
+        }
+    }
+
+    // An index without the buckets of a rejected file would let its
+    // records pass doubri-other unchecked.
+    if (num_failures > 0) {
+        es << "ERROR: the index is not written because of " << num_failures << " failed MinHash file(s)" << std::endl;
+        return 1;
+    }
+    bs.resize(group.num_buckets);
+
+    // Save the settings of the MinHash values in the index.
+    {
+        std::string header_filename = index_filename + ".header";
+        std::ofstream ofs(header_filename, std::ios::binary);
+        if (ofs.fail()) {
+            es << "ERROR: could not open the index header: " << header_filename << std::endl;
+            return 1;
+        }
+        group.num_records = 0;
+        group.finalize();
+        write_header(ofs, group);
+    }
+
+    // Save the content fingerprints of the records checked in the group
+    // (removing the stale one of the index when there are none).
+    std::string content_filename = index_filename + CONTENT_SUFFIX;
+    std::remove(content_filename.c_str());
+    if (contents.size() > 0) {
+        std::ofstream ofs(content_filename, std::ios::binary);
+        if (ofs.fail()) {
+            es << "ERROR: could not open the index file: " << content_filename << std::endl;
+            return 1;
+        }
+        contents.write(ofs);
     }
 
     // Save the index (sorted buckets) to files.
-    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+    for (size_t i = 0; i < bs.size(); ++i) {
         // Open the index file.
         std::ostringstream oss;
         oss << index_filename << '.'
@@ -234,11 +366,68 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        // Write the index file (sorted buckets).
-        for (auto it = bs[i].begin(); it != bs[i].end(); ++it) {
-            ofs.write(reinterpret_cast<const char*>(it->data()), it->size());
+        // Write the index file (sorted buckets), and release the table.
+        for (uint32_t k : bs[i].sorted()) {
+            ofs.write(bucket_data(bs[i][k], byte_per_bucket), byte_per_bucket);
         }
+        bs[i].clear();
     }
 
     return 0;
 }
+
+int main(int argc, char *argv[])
+{
+    std::istream& is = std::cin;
+    std::ostream& es = std::cerr;
+
+    // Parse the options before the index file.
+    int first = 1;
+    size_t num_threads = 1;
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+        std::string_view arg(argv[first]);
+        if (arg == "-j" && first + 1 < argc) {
+            if (!parse_number(argv[++first], num_threads, 1, 1024)) {
+                es << "ERROR: invalid value for " << arg << ": " << argv[first] << std::endl;
+                es << "USAGE: " << argv[0] << " [-j N] INDEX_FILE" << std::endl;
+                return 1;
+            }
+        } else {
+            es << "ERROR: unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (argc <= first) {
+        es << "USAGE: " << argv[0] << " [-j N] INDEX_FILE" << std::endl;
+        return 1;
+    }
+    std::string index_filename(argv[first]);
+
+    // Read the names of source files.
+    std::vector<std::string> hash_filenames;
+    for (;;) {
+        std::string line;
+        std::getline(is, line);
+        if (is.eof()) {
+            break;
+        }
+        hash_filenames.push_back(line);
+    }
+
+    // Choose the type of buckets from the first readable hash file (a
+    // type of the fixed size for the common configurations).
+    uint32_t byte_per_bucket = BYTE_PER_BUCKET;
+    for (const auto& hash_filename : hash_filenames) {
+        std::ifstream ifs(hash_filename, std::ios::binary);
+        hash_header header;
+        std::string message;
+        if (!ifs.fail() && read_header(ifs, header, message)) {
+            byte_per_bucket = header.byte_per_bucket;
+            break;
+        }
+    }
+
+    return dispatch_bucket(byte_per_bucket, [&](auto bucket) {
+        return run<decltype(bucket)>(hash_filenames, byte_per_bucket, index_filename, num_threads);
+    });
+}
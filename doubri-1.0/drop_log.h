@@ -0,0 +1,179 @@
+/*
+    Sorted logs of the records dropped by a deduplication pass.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "flag_store.h"
+#include "mapped_file.h"
+
+/*
+    The drop log of MINHASH_FILE by a pass named NAME is
+    MINHASH_FILE.NAME.drop, which stores the ids (line numbers) of the
+    records dropped by the pass in ascending order:
+        char[8]     "DropLog1"
+        uint64_t    num_records (of MINHASH_FILE)
+        uint64_t    num_drops
+        uint8_t[]   num_drops gaps in LEB128 (the first id, and then the
+                    difference from the previous id)
+*/
+#define DROP_SUFFIX ".drop"
+
+inline std::string drop_log_filename(const std::string& hash_filename, const std::string& name)
+{
+    return hash_filename + "." + name + DROP_SUFFIX;
+}
+
+static const char drop_log_magic[8] = {'D', 'r', 'o', 'p', 'L', 'o', 'g', '1'};
+static const size_t drop_log_header_size = 24;
+
+/*
+    Build a drop log from the ids appended in ascending order.
+*/
+class drop_log_writer
+{
+protected:
+    uint64_t m_num_records = 0;
+    uint64_t m_num_drops = 0;
+    uint64_t m_last = 0;
+    std::string m_data;
+    std::string m_error;
+
+public:
+    drop_log_writer(uint64_t num_records = 0) : m_num_records(num_records)
+    {
+    }
+
+    void append(uint64_t id)
+    {
+        uint64_t gap = m_num_drops ? id - m_last : id;
+        while (gap >= 0x80) {
+            m_data += static_cast<char>((gap & 0x7F) | 0x80);
+            gap >>= 7;
+        }
+        m_data += static_cast<char>(gap);
+        m_last = id;
+        ++m_num_drops;
+    }
+
+    uint64_t num_drops() const
+    {
+        return m_num_drops;
+    }
+
+    /*
+        Write the drop log to the file atomically. Return false with an
+        error message on failure.
+    */
+    bool save(const std::string& filename)
+    {
+        std::string data(drop_log_header_size, '\0');
+        std::memcpy(&data[0], drop_log_magic, sizeof(drop_log_magic));
+        std::memcpy(&data[8], &m_num_records, sizeof(uint64_t));
+        std::memcpy(&data[16], &m_num_drops, sizeof(uint64_t));
+        data += m_data;
+        return replace_file(filename, data, 0644, m_error);
+    }
+
+    const std::string& error() const
+    {
+        return m_error;
+    }
+};
+
+/*
+    Read the ids of a memory-mapped drop log in ascending order.
+*/
+class drop_log_reader : public mapped_file
+{
+protected:
+    uint64_t m_num_records = 0;
+    uint64_t m_num_drops = 0;
+    uint64_t m_num_read = 0;
+    uint64_t m_last = 0;
+    const char *m_p = nullptr;
+
+public:
+    /*
+        Map the drop log and read its header. Return false with an error
+        message on failure.
+    */
+    bool open(const std::string& filename)
+    {
+        if (!mapped_file::open(filename)) {
+            return false;
+        }
+        if (size() < drop_log_header_size || std::memcmp(data(), drop_log_magic, sizeof(drop_log_magic)) != 0) {
+            m_error = "not a drop log: " + filename;
+            return false;
+        }
+        std::memcpy(&m_num_records, data() + 8, sizeof(uint64_t));
+        std::memcpy(&m_num_drops, data() + 16, sizeof(uint64_t));
+        m_p = data() + drop_log_header_size;
+        m_num_read = 0;
+        advise(MADV_SEQUENTIAL);
+        return true;
+    }
+
+    uint64_t num_records() const
+    {
+        return m_num_records;
+    }
+
+    uint64_t num_drops() const
+    {
+        return m_num_drops;
+    }
+
+    /*
+        Read the next id. Return false at the end of the log, or when the
+        log is broken (with an error message).
+    */
+    bool next(uint64_t& id)
+    {
+        if (m_num_read == m_num_drops) {
+            return false;
+        }
+
+        const char *end = data() + size();
+        uint64_t gap = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (m_p == end || shift > 63) {
+                m_error = "the drop log is truncated";
+                return false;
+            }
+            const uint8_t c = static_cast<uint8_t>(*m_p++);
+            gap |= static_cast<uint64_t>(c & 0x7F) << shift;
+            if (!(c & 0x80)) {
+                break;
+            }
+        }
+        id = m_num_read ? m_last + gap : gap;
+        m_last = id;
+        ++m_num_read;
+        return true;
+    }
+};
@@ -22,53 +22,107 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-#include <fstream>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include "compressed_stream.h"
+#include "flag_store.h"
+
+void usage(std::ostream& os, const char *argv0)
+{
+    os << "USAGE: " << argv0 << " [OPTIONS] FLAG_FILE" << std::endl;
+    os << "Read JSONL documents (plain, gzip, or zstd) from STDIN and write the ones" << std::endl;
+    os << "whose flags are '1' to STDOUT. FLAG_FILE may be in the text or the" << std::endl;
+    os << "bit-packed format." << std::endl;
+    os << std::endl;
+    os << "OPTIONS:" << std::endl;
+    os << "    --compress NAME    compress the output: plain (default), gzip, zstd" << std::endl;
+    os << "    -h, --help         show this help message and exit" << std::endl;
+}
 
 int main(int argc, char *argv[])
 {
-    size_t num = 0;
+    int format = FORMAT_PLAIN;
+    const char *flag_filename = nullptr;
     std::istream& is = std::cin;
     std::ostream& os = std::cout;
     std::ostream& es = std::cerr;
 
-    // Open the flag file.
-    std::ifstream ifs(argv[1]);
-    if (ifs.fail()) {
-        es << "ERROR: Failed to open " << argv[1] << std::endl;
+    // Parse the command-line arguments.
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            usage(os, argv[0]);
+            return 0;
+        } else if (arg == "--compress" && i + 1 < argc) {
+            std::string_view value(argv[++i]);
+            format = format_from_name(value);
+            if (format < 0) {
+                es << "ERROR: unknown format: " << value << std::endl;
+                return 1;
+            } else if (!format_supported(format)) {
+                es << "ERROR: this build cannot write " << value << " streams" << std::endl;
+                return 1;
+            }
+        } else if (!arg.empty() && arg[0] == '-') {
+            es << "ERROR: unknown option: " << arg << std::endl;
+            usage(es, argv[0]);
+            return 1;
+        } else if (flag_filename == nullptr) {
+            flag_filename = argv[i];
+        } else {
+            usage(es, argv[0]);
+            return 1;
+        }
+    }
+    if (flag_filename == nullptr) {
+        usage(es, argv[0]);
         return 1;
     }
-    
-    // One JSON object per line.
-    for (;;) {
-        char c = 0;
 
+    // Read the flags (in either format).
+    flag_store flags;
+    if (!flags.load(flag_filename)) {
+        es << "ERROR: " << flags.error() << std::endl;
+        return 1;
+    }
+
+    line_reader reader(is);
+    compressed_writer writer(os, format);
+
+    // One JSON object per line.
+    std::string_view line;
+    for (size_t i = 0; ; ++i) {
         // Read a line from STDIN.
-        std::string line;
-        std::getline(is, line);
-        if (is.eof()) {
+        if (!reader.getline(line)) {
+            if (!reader.error().empty()) {
+                es << "ERROR: " << reader.error() << std::endl;
+                return 1;
+            }
+
             // Make sure that the flag file also hits EOF at the same time.
-            ifs >> c;
-            if (!ifs.eof()) {
+            if (i != flags.size()) {
                 es << "ERROR: Premature end of the input stream." << std::endl;
                 return 1;
             }
             break;
         }
 
-        // Read a flag.
-        ifs >> c;
-        if (ifs.eof()) {
+        if (flags.size() <= i) {
             es << "ERROR: Premature end of the flag file." << std::endl;
             return 1;
         }
 
-        // Output the line if the flag is true ('1').
-        if (c == '1') {
-            os << line << std::endl;
+        // Output the line if the flag is true (1).
+        if (flags.active(i)) {
+            writer.write(line);
+            writer.write("\n", 1);
         }
     }
 
+    if (!writer.finish()) {
+        es << "ERROR: Failed to write the output." << std::endl;
+        return 1;
+    }
     return 0;
 }
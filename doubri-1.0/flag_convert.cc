@@ -0,0 +1,103 @@
+/*
+    Convert flag files between the text and the bit-packed formats.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "common.h"
+#include "flag_store.h"
+
+void usage(std::ostream& os, const char *argv0)
+{
+    os << "USAGE: " << argv0 << " [OPTIONS] FLAG_FILE [FLAG_FILE ...]" << std::endl;
+    os << "Convert the flag files (in place) to the format." << std::endl;
+    os << std::endl;
+    os << "OPTIONS:" << std::endl;
+    os << "    --to FORMAT        the format of the flag files: packed (default), text" << std::endl;
+    os << "    -h, --help         show this help message and exit" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int format = FLAG_PACKED;
+    int first = argc;
+    std::ostream& os = std::cout;
+    std::ostream& es = std::cerr;
+
+    // Parse the command-line arguments.
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            usage(os, argv[0]);
+            return 0;
+        } else if (arg == "--to" && i + 1 < argc) {
+            std::string_view value(argv[++i]);
+            format = flag_format_from_name(value);
+            if (format < 0) {
+                es << "ERROR: unknown flag format: " << value << std::endl;
+                return 1;
+            }
+        } else if (!arg.empty() && arg[0] == '-') {
+            es << "ERROR: unknown option: " << arg << std::endl;
+            usage(es, argv[0]);
+            return 1;
+        } else {
+            first = i;
+            break;
+        }
+    }
+    if (first == argc) {
+        usage(es, argv[0]);
+        return 1;
+    }
+
+    // Convert the flag files, and report the stats to STDOUT.
+    for (int i = first; i < argc; ++i) {
+        flag_store flags;
+        if (!flags.load(argv[i])) {
+            es << "ERROR: " << flags.error() << std::endl;
+            return 1;
+        }
+        const int source = flags.format();
+        if (source != format) {
+            flags.set_format(format);
+            if (!flags.save()) {
+                es << "ERROR: " << flags.error() << std::endl;
+                return 1;
+            }
+        }
+
+        const size_t num_total = flags.size();
+        const size_t num_active = flags.count();
+        os << '{' <<
+            kv("target", argv[i]) << ", " <<
+            kv("source", flag_format_name(source)) << ", " <<
+            kv("format", flag_format_name(format)) << ", " <<
+            kv("num_total", num_total) << ", " <<
+            kv("num_active", num_active) <<
+            '}' << std::endl;
+    }
+    return 0;
+}
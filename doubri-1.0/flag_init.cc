@@ -33,48 +33,71 @@ SOFTWARE.
 #include <string>
 #include <string_view>
 
-#define BYTE_PER_HASH 4
-#define BUCKET_SIZE 20
-#define BYTE_PER_BUCKET (BYTE_PER_HASH * BUCKET_SIZE)
-#define NUM_BUCKETS 40
-#define BYTE_PER_RECORD (BYTE_PER_BUCKET * NUM_BUCKETS)
+#include "flag_store.h"
+#include "hashfile.h"
+
+void usage(std::ostream& os, const char *argv0)
+{
+    os << "USAGE: " << argv0 << " [OPTIONS] MINHASH_FILE" << std::endl;
+    os << "Write active flags for all records of MINHASH_FILE to STDOUT." << std::endl;
+    os << std::endl;
+    os << "OPTIONS:" << std::endl;
+    os << "    --packed           write the flags in the bit-packed format" << std::endl;
+    os << "    -h, --help         show this help message and exit" << std::endl;
+}
 
 int main(int argc, char *argv[])
 {
+    bool packed = false;
+    const char *hash_filename = nullptr;
     std::ostream& os = std::cout;
     std::ostream& es = std::cerr;
-    const char *hash_filename = argv[1];
 
-    // Open the hash file for reading (binary).
-    std::ifstream ifs(hash_filename, std::ios::binary);
-    if (ifs.fail()) {
-        es << "ERROR: could not open the hash file: " << hash_filename << std::endl;
-        return 1;
+    // Parse the command-line arguments.
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            usage(os, argv[0]);
+            return 0;
+        } else if (arg == "--packed") {
+            packed = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            es << "ERROR: unknown option: " << arg << std::endl;
+            usage(es, argv[0]);
+            return 1;
+        } else if (hash_filename == nullptr) {
+            hash_filename = argv[i];
+        } else {
+            usage(es, argv[0]);
+            return 1;
+        }
     }
-
-    // Read the header and check consistencies.
-    char magic[8]{};
-    ifs.read(magic, 7);
-    if (std::strcmp(magic, "MinHash") != 0) {
-        es << "ERROR: unrecognized header: " << magic << std::endl;
+    if (hash_filename == nullptr) {
+        usage(es, argv[0]);
         return 1;
     }
 
-    // Check the consistency of size_t;
-    uint8_t byte_per_hash;
-    ifs.read(reinterpret_cast<char*>(&byte_per_hash), 1);
-    if (byte_per_hash != 4) {
-        es << "ERROR: Hash size is not 4 bytes but " << byte_per_hash << std::endl;
+    // Map the hash file and read its header (which also checks the size).
+    hash_reader reader;
+    if (!reader.open(hash_filename)) {
+        es << "ERROR: " << reader.error() << std::endl;
         return 1;
     }
+    size_t num_records = reader.num_records();
 
-    // Read the number of records.
-    size_t num_records;
-    ifs.read(reinterpret_cast<char*>(&num_records), sizeof(num_records));
+    // Output the flags of the bit-packed format.
+    if (packed) {
+        flag_store flags;
+        flags.assign(num_records, FLAG_PACKED);
+        const std::string data = flags.encode();
+        os.write(data.data(), data.size());
+        return 0;
+    }
 
-    // Output '1' for all records.
-    for (size_t i = 0; i < num_records; ++i) {
-        os << '1';
+    // Output '1' for all records (in chunks).
+    const std::string ones(65536, '1');
+    for (size_t i = 0; i < num_records; i += ones.size()) {
+        os.write(ones.data(), std::min(ones.size(), num_records - i));
     }
 
     return 0;
@@ -0,0 +1,167 @@
+/*
+    Fold drop logs into a flag file.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "drop_log.h"
+#include "flag_store.h"
+
+void usage(std::ostream& os, const char *argv0)
+{
+    os << "USAGE: " << argv0 << " [OPTIONS] FLAG_FILE DROP_LOG [DROP_LOG ...]" << std::endl;
+    os << "Set the flags of the records in the drop logs to '0', and write the flag" << std::endl;
+    os << "file back (in place)." << std::endl;
+    os << std::endl;
+    os << "OPTIONS:" << std::endl;
+    os << "    --remove           remove the drop logs after updating the flag file" << std::endl;
+    os << "    -h, --help         show this help message and exit" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    bool remove = false;
+    int first = argc;
+    std::ostream& os = std::cout;
+    std::ostream& es = std::cerr;
+
+    // Parse the command-line arguments.
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            usage(os, argv[0]);
+            return 0;
+        } else if (arg == "--remove") {
+            remove = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            es << "ERROR: unknown option: " << arg << std::endl;
+            usage(es, argv[0]);
+            return 1;
+        } else {
+            first = i;
+            break;
+        }
+    }
+    if (argc - first < 2) {
+        usage(es, argv[0]);
+        return 1;
+    }
+    const std::string flag_filename(argv[first]);
+
+    // Read the flags.
+    flag_store flags;
+    if (!flags.load(flag_filename)) {
+        es << "ERROR: " << flags.error() << std::endl;
+        return 1;
+    }
+
+    // Open the drop logs.
+    std::vector<std::unique_ptr<drop_log_reader> > logs;
+    size_t num_ids = 0;
+    for (int i = first + 1; i < argc; ++i) {
+        std::unique_ptr<drop_log_reader> log(new drop_log_reader);
+        if (!log->open(argv[i])) {
+            es << "ERROR: " << log->error() << std::endl;
+            return 1;
+        }
+        if (log->num_records() != flags.size()) {
+            es << "ERROR: the drop log is for " << log->num_records() << " records, not " << flags.size() << ": " << argv[i] << std::endl;
+            return 1;
+        }
+        num_ids += log->num_drops();
+        logs.push_back(std::move(log));
+    }
+
+    // Merge the ids of the logs in ascending order (k-way merge), so that
+    // the flags are updated from the beginning to the end.
+    typedef std::pair<uint64_t, size_t> item_type;
+    std::priority_queue<item_type, std::vector<item_type>, std::greater<item_type> > heap;
+    auto advance = [&](size_t k) {
+        uint64_t id;
+        if (logs[k]->next(id)) {
+            heap.emplace(id, k);
+            return true;
+        }
+        return logs[k]->error().empty();
+    };
+    for (size_t k = 0; k < logs.size(); ++k) {
+        if (!advance(k)) {
+            es << "ERROR: " << logs[k]->error() << ": " << argv[first + 1 + k] << std::endl;
+            return 1;
+        }
+    }
+
+    size_t num_drops = 0;
+    while (!heap.empty()) {
+        const auto [id, k] = heap.top();
+        heap.pop();
+        if (flags.size() <= id) {
+            es << "ERROR: a record id out of range: " << id << ": " << argv[first + 1 + k] << std::endl;
+            return 1;
+        }
+        if (flags.active(id)) {
+            flags.drop(id);
+            ++num_drops;
+        }
+        if (!advance(k)) {
+            es << "ERROR: " << logs[k]->error() << ": " << argv[first + 1 + k] << std::endl;
+            return 1;
+        }
+    }
+
+    // Write the flags back to the flag file.
+    if (!flags.save()) {
+        es << "ERROR: " << flags.error() << std::endl;
+        return 1;
+    }
+
+    // Remove the drop logs (after the flag file is updated).
+    if (remove) {
+        for (int i = first + 1; i < argc; ++i) {
+            std::remove(argv[i]);
+        }
+    }
+
+    // Report the stats to STDOUT.
+    const size_t num_total = flags.size();
+    const size_t num_active = flags.count();
+    os << '{' <<
+        kv("target", flag_filename) << ", " <<
+        kv("num_logs", logs.size()) << ", " <<
+        kv("num_ids", num_ids) << ", " <<
+        kv("num_total", num_total) << ", " <<
+        kv("num_active", num_active) << ", " <<
+        kv("num_drops", num_drops) << ", " <<
+        kv("active_rate", num_active / (double)num_total) <<
+        '}' << std::endl;
+    return 0;
+}
@@ -0,0 +1,437 @@
+/*
+    In-memory flags of the records of a MinHash file.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+
+/*
+    The flag file of MINHASH_FILE is MINHASH_FILE.f, which stores whether
+    each record is active (1) or removed (0).
+*/
+#define FLAG_SUFFIX ".f"
+
+/*
+    Formats of a flag file.
+
+    Text: one character per record, '1' for active and '0' for removed
+    (a trailing newline is ignored, and is not written back).
+
+    Packed (1 bit per record):
+        char[8]     "BitFlags"
+        uint64_t    num_records
+        uint64_t    checksum (flag_checksum() of the words)
+        uint64_t[]  ceil(num_records / 64) words; the record #i is the bit
+                    (i % 64) of the word #(i / 64), and the unused bits of
+                    the last word are zero.
+*/
+enum flag_format {
+    FLAG_TEXT = 0,
+    FLAG_PACKED = 1,
+};
+
+inline int flag_format_from_name(std::string_view name)
+{
+    if (name == "text") {
+        return FLAG_TEXT;
+    } else if (name == "packed") {
+        return FLAG_PACKED;
+    }
+    return -1;
+}
+
+inline const char *flag_format_name(int format)
+{
+    switch (format) {
+    case FLAG_TEXT:
+        return "text";
+    case FLAG_PACKED:
+        return "packed";
+    default:
+        return "unknown";
+    }
+}
+
+static const char flag_magic[8] = {'B', 'i', 't', 'F', 'l', 'a', 'g', 's'};
+static const size_t flag_header_size = 24;
+
+inline uint64_t flag_checksum(const uint64_t *words, size_t n)
+{
+    uint64_t h = 0x243F6A8885A308D3ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h = (h ^ words[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/*
+    Write the data to a temporary file next to the file, rename it to the
+    file, and sync the directory, so that the file is either the old one or
+    the new one even if the process is killed or the system crashes. Return
+    false with an error message on failure.
+*/
+inline bool replace_file(const std::string& filename, const std::string& data, mode_t mode, std::string& message)
+{
+    const std::string tmp = filename + ".tmp." + std::to_string(getpid());
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        message = "could not create " + tmp + ": " + std::strerror(errno);
+        return false;
+    }
+
+    // Write the data, keeping the errno of the first failure.
+    int error = 0;
+    if (fchmod(fd, mode) != 0) {
+        error = errno;
+    }
+    for (size_t offset = 0; !error && offset < data.size(); ) {
+        const ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            error = errno;
+        } else if (n == 0) {
+            error = EIO;
+        }
+        offset += (n > 0) ? n : 0;
+    }
+    if (!error && fsync(fd) != 0) {
+        error = errno;
+    }
+    if (::close(fd) != 0 && !error) {
+        error = errno;
+    }
+    if (!error && std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        error = errno;
+    }
+    if (error) {
+        message = "failed to write " + filename + ": " + std::strerror(error);
+        std::remove(tmp.c_str());
+        return false;
+    }
+
+    // Make the rename durable.
+    const size_t slash = filename.find_last_of('/');
+    const std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : filename.substr(0, slash));
+    int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dfd < 0 || fsync(dfd) != 0) {
+        message = "failed to sync the directory " + dir + ": " + std::strerror(errno);
+        if (dfd >= 0) {
+            ::close(dfd);
+        }
+        return false;
+    }
+    ::close(dfd);
+    return true;
+}
+
+/*
+    The flags of a flag file, loaded at once and updated in memory (one
+    bit per record). save() writes the flags in the format of the loaded
+    file to a temporary file, renames it to the flag file, and syncs the
+    directory, so that the flag file is either the old one or the new one
+    even if the process is killed in the middle of a task or the system
+    crashes.
+
+    Flags only change from 1 to 0, so save() also keeps the drops that
+    another process saved to the same flag file in the meantime: it locks
+    the current flag file, and writes the flags active in both.
+*/
+class flag_store
+{
+protected:
+    std::string m_filename;
+    std::vector<uint64_t> m_words;
+    size_t m_size = 0;
+    int m_format = FLAG_TEXT;
+    std::string m_error;
+
+public:
+    /*
+        Set n flags to active (without a file).
+    */
+    void assign(size_t n, int format)
+    {
+        m_size = n;
+        m_format = format;
+        m_words.assign((n + 63) / 64, ~0ULL);
+        clear_padding();
+    }
+
+    /*
+        Read the flags in either format. Return false with an error message
+        when the file is unreadable or broken.
+    */
+    bool load(const std::string& filename)
+    {
+        m_filename = filename;
+        mapped_file file;
+        if (!file.open(filename)) {
+            m_error = "could not open the flag file: " + filename;
+            return false;
+        }
+        file.advise(MADV_SEQUENTIAL);
+        return decode(file.data(), file.size(), m_words, m_size, m_format, m_error, filename);
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    int format() const
+    {
+        return m_format;
+    }
+
+    void set_format(int format)
+    {
+        m_format = format;
+    }
+
+    bool active(size_t i) const
+    {
+        return (m_words[i >> 6] >> (i & 63)) & 1;
+    }
+
+    void drop(size_t i)
+    {
+        m_words[i >> 6] &= ~(1ULL << (i & 63));
+    }
+
+    /*
+        The words of the flags (64 records per word) for combining flags.
+    */
+    std::vector<uint64_t>& words()
+    {
+        return m_words;
+    }
+
+    const std::vector<uint64_t>& words() const
+    {
+        return m_words;
+    }
+
+    /*
+        Count the active records.
+    */
+    size_t count() const
+    {
+        size_t n = 0;
+        for (uint64_t w : m_words) {
+            n += __builtin_popcountll(w);
+        }
+        return n;
+    }
+
+    /*
+        Encode the flags in the format.
+    */
+    std::string encode() const
+    {
+        std::string data;
+        if (m_format == FLAG_PACKED) {
+            const uint64_t checksum = flag_checksum(m_words.data(), m_words.size());
+            data.resize(flag_header_size + m_words.size() * sizeof(uint64_t));
+            std::memcpy(&data[0], flag_magic, sizeof(flag_magic));
+            std::memcpy(&data[8], &m_size, sizeof(uint64_t));
+            std::memcpy(&data[16], &checksum, sizeof(uint64_t));
+            std::memcpy(&data[flag_header_size], m_words.data(), m_words.size() * sizeof(uint64_t));
+        } else {
+            data.resize(m_size);
+            for (size_t i = 0; i < m_size; ++i) {
+                data[i] = '0' + active(i);
+            }
+        }
+        return data;
+    }
+
+    /*
+        Write the flags back to the flag file atomically. Return false with
+        an error message on failure (leaving the flag file untouched).
+    */
+    bool save()
+    {
+        // Lock the current flag file (which another process may replace
+        // while this process waits for the lock). A removed flag file is
+        // simply written again.
+        int fd = -1;
+        for (;;) {
+            fd = ::open(m_filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (errno == ENOENT) {
+                    break;
+                }
+                m_error = "could not open the flag file: " + m_filename + ": " + std::strerror(errno);
+                return false;
+            }
+            if (flock(fd, LOCK_EX) != 0) {
+                const int error = errno;
+                ::close(fd);
+                if (error == EINTR) {
+                    continue;
+                }
+                m_error = "could not lock the flag file: " + m_filename + ": " + std::strerror(error);
+                return false;
+            }
+            struct stat fst, pst;
+            if (fstat(fd, &fst) != 0) {
+                const int error = errno;
+                ::close(fd);
+                m_error = "failed to stat the flag file: " + m_filename + ": " + std::strerror(error);
+                return false;
+            }
+            const int rc = stat(m_filename.c_str(), &pst);
+            const int error = errno;
+            if (rc == 0 && fst.st_dev == pst.st_dev && fst.st_ino == pst.st_ino) {
+                break;
+            }
+            ::close(fd);
+            if (rc != 0 && error != ENOENT && error != EINTR) {
+                m_error = "failed to stat the flag file: " + m_filename + ": " + std::strerror(error);
+                return false;
+            }
+            // The flag file was replaced (or removed) while waiting: retry.
+        }
+
+        // Keep the drops saved by another process.
+        mode_t mode = 0644;
+        if (fd >= 0) {
+            struct stat st;
+            std::string current;
+            std::vector<uint64_t> words;
+            size_t size = 0;
+            int format = 0;
+            std::string message;
+            if (fstat(fd, &st) == 0) {
+                mode = st.st_mode & 07777;
+            }
+            if (read_all(fd, current) && decode(current.data(), current.size(), words, size, format, message, m_filename) && size == m_size) {
+                for (size_t i = 0; i < m_words.size(); ++i) {
+                    m_words[i] &= words[i];
+                }
+            }
+        }
+
+        const bool success = write_file(mode);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return success;
+    }
+
+    const std::string& error() const
+    {
+        return m_error;
+    }
+
+protected:
+    void clear_padding()
+    {
+        if (m_size & 63) {
+            m_words.back() &= (1ULL << (m_size & 63)) - 1;
+        }
+    }
+
+    static bool decode(const char *data, size_t size, std::vector<uint64_t>& words, size_t& num_records, int& format, std::string& message, const std::string& filename)
+    {
+        if (size >= sizeof(flag_magic) && std::memcmp(data, flag_magic, sizeof(flag_magic)) == 0) {
+            uint64_t n = 0, checksum = 0;
+            if (size >= flag_header_size) {
+                std::memcpy(&n, data + 8, sizeof(uint64_t));
+                std::memcpy(&checksum, data + 16, sizeof(uint64_t));
+            }
+            const uint64_t num_words = (n + 63) / 64;
+            if (size < flag_header_size || n > (size - flag_header_size) * 8 || size != flag_header_size + num_words * sizeof(uint64_t)) {
+                message = "the flag file is truncated: " + filename;
+                return false;
+            }
+            words.resize(num_words);
+            std::memcpy(words.data(), data + flag_header_size, num_words * sizeof(uint64_t));
+            if (flag_checksum(words.data(), words.size()) != checksum) {
+                message = "checksum mismatch in the flag file: " + filename;
+                return false;
+            }
+            num_records = n;
+            format = FLAG_PACKED;
+            return true;
+        }
+
+        // A text flag file may end with a newline (e.g., written by echo).
+        if (size > 0 && data[size - 1] == '\n') {
+            size -= (size > 1 && data[size - 2] == '\r') ? 2 : 1;
+        }
+        words.assign((size + 63) / 64, 0);
+        for (size_t i = 0; i < size; ++i) {
+            const char c = data[i];
+            if (c == '1') {
+                words[i >> 6] |= 1ULL << (i & 63);
+            } else if (c != '0') {
+                message = std::string("a flag must be either '0' or '1': ") + c + " (" + filename + ")";
+                return false;
+            }
+        }
+        num_records = size;
+        format = FLAG_TEXT;
+        return true;
+    }
+
+    static bool read_all(int fd, std::string& data)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+        data.resize(st.st_size);
+        for (size_t offset = 0; offset < data.size(); ) {
+            const ssize_t n = ::pread(fd, &data[offset], data.size() - offset, offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                return false;
+            }
+            offset += n;
+        }
+        return true;
+    }
+
+    bool write_file(mode_t mode)
+    {
+        return replace_file(m_filename, encode(), mode, m_error);
+    }
+};
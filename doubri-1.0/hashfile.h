@@ -0,0 +1,543 @@
+/*
+    MinHash file header.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "common.h"
+#include "mapped_file.h"
+
+/*
+    Signature engines (how MinHash values are computed from n-grams).
+*/
+enum minhash_engine {
+    ENGINE_MURMUR32 = 0,    // MurmurHash3_x86_32 with seeds 0, 1, ..., 799.
+    ENGINE_PERMUTE = 1,     // 64-bit hash once, (a_i x + b_i) mod p for each i.
+    ENGINE_MURMUR128 = 2,   // MurmurHash3_x64_128 with seeds 0, 1, ..., 199.
+    ENGINE_OPH = 3,         // One permutation hashing with densification.
+};
+
+inline int engine_from_name(std::string_view name)
+{
+    if (name == "murmur32") {
+        return ENGINE_MURMUR32;
+    } else if (name == "murmur128") {
+        return ENGINE_MURMUR128;
+    } else if (name == "permute") {
+        return ENGINE_PERMUTE;
+    } else if (name == "oph") {
+        return ENGINE_OPH;
+    }
+    return -1;
+}
+
+inline const char *engine_name(int engine)
+{
+    switch (engine) {
+    case ENGINE_MURMUR32:
+        return "murmur32";
+    case ENGINE_PERMUTE:
+        return "permute";
+    case ENGINE_MURMUR128:
+        return "murmur128";
+    case ENGINE_OPH:
+        return "oph";
+    default:
+        return "unknown";
+    }
+}
+
+/*
+    Features (how the base hash values of n-grams are computed) for the
+    engines that hash every n-gram only once (permute, oph).
+*/
+enum minhash_feature {
+    FEATURE_BYTES = 0,      // MurmurHash3_x64_128 of the UTF-8 bytes of an n-gram.
+    FEATURE_ROLLING = 1,    // Rolling polynomial hash of the code points of an n-gram.
+};
+
+inline int feature_from_name(std::string_view name)
+{
+    if (name == "bytes") {
+        return FEATURE_BYTES;
+    } else if (name == "rolling") {
+        return FEATURE_ROLLING;
+    }
+    return -1;
+}
+
+inline const char *feature_name(int feature)
+{
+    switch (feature) {
+    case FEATURE_BYTES:
+        return "bytes";
+    case FEATURE_ROLLING:
+        return "rolling";
+    default:
+        return "unknown";
+    }
+}
+
+/*
+    Header of a MinHash file.
+
+    Version 1 (24 bytes), written for the default settings so that existing
+    tools can read the file:
+        char[7]     "MinHash"
+        uint8_t     byte_per_hash (4)
+        uint64_t    num_records
+        uint64_t    num_hash_values
+
+    Version 2 (64 bytes), written for other settings:
+        char[8]     "MinHash2"
+        uint64_t    num_records
+        uint64_t    num_hash_values
+        uint32_t    header_size (64)
+        uint8_t     byte_per_hash (4)
+        uint8_t     engine
+        uint8_t     feature
+        uint8_t     (reserved)
+        uint64_t    seed
+        uint32_t    byte_per_bucket (4r, or 8 or 16 for fingerprints)
+        uint32_t    ngram_size (n)
+        uint32_t    bucket_size (r)
+        uint32_t    num_buckets (b)
+        uint32_t    block_size (0 for the row-major layout)
+        uint32_t    (reserved)
+
+    A record consists of b buckets of byte_per_bucket bytes. A bucket is
+    either r hash values (4r bytes) or the fingerprint of the hash values
+    (the first 8 or all 16 bytes of MurmurHash3_x64_128 of the 4r bytes).
+
+    The records are stored in the row-major layout (record by record) by
+    default. With block_size > 0, the records are split into blocks of
+    block_size records (the last block may be shorter), and a block stores
+    the bucket #0 of its records, the bucket #1 of its records, and so on
+    (blocked column-major layout). A reader can then stream a bucket (a
+    column) of all records with one contiguous read per block.
+
+    The eighth byte ('2') makes older tools reject a version-2 file with
+    an error on byte_per_hash.
+*/
+struct hash_header {
+    int version = 1;
+    uint8_t byte_per_hash = BYTE_PER_HASH;
+    uint64_t num_records = 0;
+    uint64_t num_hash_values = BUCKET_SIZE * NUM_BUCKETS;
+    uint32_t header_size = 24;
+    uint8_t engine = ENGINE_MURMUR32;
+    uint8_t feature = FEATURE_BYTES;
+    uint64_t seed = 0;
+    uint32_t byte_per_bucket = BYTE_PER_BUCKET;
+    uint32_t ngram_size = NGRAM_SIZE;
+    uint32_t bucket_size = BUCKET_SIZE;
+    uint32_t num_buckets = NUM_BUCKETS;
+    uint32_t block_size = 0;
+
+    /*
+        Set the parameters (n, r, b) and the number of hash values.
+    */
+    void set_parameters(uint32_t n, uint32_t r, uint32_t b)
+    {
+        ngram_size = n;
+        bucket_size = r;
+        num_buckets = b;
+        num_hash_values = static_cast<uint64_t>(r) * b;
+        byte_per_bucket = byte_per_hash * r;
+    }
+
+    /*
+        Fix the version and header size from the settings.
+    */
+    void finalize()
+    {
+        if (engine == ENGINE_MURMUR32 && feature == FEATURE_BYTES && seed == 0 && byte_per_bucket == BYTE_PER_BUCKET &&
+            ngram_size == NGRAM_SIZE && bucket_size == BUCKET_SIZE && num_buckets == NUM_BUCKETS &&
+            block_size == 0) {
+            version = 1;
+            header_size = 24;
+        } else {
+            version = 2;
+            header_size = 64;
+        }
+    }
+
+    /*
+        Whether the buckets are fingerprints of the hash values.
+    */
+    bool fingerprint() const
+    {
+        return byte_per_bucket != byte_per_hash * bucket_size;
+    }
+
+    /*
+        The size of a record in bytes.
+    */
+    size_t record_size() const
+    {
+        return static_cast<size_t>(byte_per_bucket) * num_buckets;
+    }
+
+    /*
+        The offset of the bucket #j of the record #i in the file.
+    */
+    uint64_t bucket_offset(uint64_t i, size_t j) const
+    {
+        if (block_size == 0) {
+            return header_size + record_size() * i + static_cast<uint64_t>(byte_per_bucket) * j;
+        }
+        const uint64_t first = i - i % block_size;
+        const uint64_t num = std::min<uint64_t>(block_size, num_records - first);
+        return header_size + record_size() * first + byte_per_bucket * (num * j + (i - first));
+    }
+
+    /*
+        Check whether MinHash values of two files are comparable.
+    */
+    bool compatible(const hash_header& other) const
+    {
+        return
+            byte_per_hash == other.byte_per_hash &&
+            num_hash_values == other.num_hash_values &&
+            engine == other.engine &&
+            feature == other.feature &&
+            seed == other.seed &&
+            byte_per_bucket == other.byte_per_bucket &&
+            ngram_size == other.ngram_size &&
+            bucket_size == other.bucket_size &&
+            num_buckets == other.num_buckets;
+    }
+
+    std::string describe() const
+    {
+        std::stringstream ss;
+        ss << "engine=" << engine_name(engine) << ", feature=" << feature_name(feature) << ", seed=" << seed <<
+            ", byte_per_hash=" << (int)byte_per_hash <<
+            ", num_hash_values=" << num_hash_values <<
+            ", byte_per_bucket=" << byte_per_bucket <<
+            ", n=" << ngram_size << ", r=" << bucket_size << ", b=" << num_buckets;
+        if (block_size != 0) {
+            ss << ", block_size=" << block_size;
+        }
+        return ss.str();
+    }
+};
+
+template <typename T>
+void write_value(std::ostream& os, const T& value)
+{
+    os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read_value(std::istream& is, T& value)
+{
+    is.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return !is.fail();
+}
+
+/*
+    Write the header to the stream (call finalize() beforehand).
+*/
+inline void write_header(std::ostream& os, const hash_header& header)
+{
+    if (header.version == 1) {
+        os.write("MinHash", 7);
+        write_value(os, header.byte_per_hash);
+        write_value(os, header.num_records);
+        write_value(os, header.num_hash_values);
+    } else {
+        const uint8_t reserved = 0;
+        os.write("MinHash2", 8);
+        write_value(os, header.num_records);
+        write_value(os, header.num_hash_values);
+        write_value(os, header.header_size);
+        write_value(os, header.byte_per_hash);
+        write_value(os, header.engine);
+        write_value(os, header.feature);
+        write_value(os, reserved);
+        write_value(os, header.seed);
+        write_value(os, header.byte_per_bucket);
+        write_value(os, header.ngram_size);
+        write_value(os, header.bucket_size);
+        write_value(os, header.num_buckets);
+        write_value(os, header.block_size);
+        write_value(os, static_cast<uint32_t>(0));
+    }
+}
+
+/*
+    Read the header from the stream, leaving the stream at the first record.
+    Return false with an error message when the header is unrecognizable.
+*/
+inline bool read_header(std::istream& is, hash_header& header, std::string& message)
+{
+    header = hash_header();
+
+    char magic[9]{};
+    is.read(magic, 8);
+    if (is.fail() || std::strncmp(magic, "MinHash", 7) != 0) {
+        magic[7] = 0;
+        message = std::string("unrecognized header: ") + magic;
+        return false;
+    }
+
+    if (magic[7] != '2') {
+        // Version 1: the eighth byte is the size of a hash value.
+        header.version = 1;
+        header.byte_per_hash = static_cast<uint8_t>(magic[7]);
+        header.header_size = 24;
+        if (!read_value(is, header.num_records) || !read_value(is, header.num_hash_values)) {
+            message = "premature end of the header";
+            return false;
+        }
+    } else {
+        uint8_t reserved;
+        uint32_t reserved2;
+        header.version = 2;
+        if (!read_value(is, header.num_records) ||
+            !read_value(is, header.num_hash_values) ||
+            !read_value(is, header.header_size) ||
+            !read_value(is, header.byte_per_hash) ||
+            !read_value(is, header.engine) ||
+            !read_value(is, header.feature) ||
+            !read_value(is, reserved) ||
+            !read_value(is, header.seed) ||
+            !read_value(is, header.byte_per_bucket) ||
+            !read_value(is, header.ngram_size) ||
+            !read_value(is, header.bucket_size) ||
+            !read_value(is, header.num_buckets) ||
+            !read_value(is, header.block_size) ||
+            !read_value(is, reserved2)) {
+            message = "premature end of the header";
+            return false;
+        }
+        if (header.header_size != 64) {
+            message = "broken header size: " + std::to_string(header.header_size);
+            return false;
+        }
+    }
+
+    if (header.byte_per_hash != BYTE_PER_HASH) {
+        message = "Hash size is not 4 bytes but " + std::to_string(header.byte_per_hash);
+        return false;
+    }
+    if (header.ngram_size == 0 || header.bucket_size == 0 || header.num_buckets == 0 ||
+        header.num_hash_values != static_cast<uint64_t>(header.bucket_size) * header.num_buckets) {
+        std::stringstream ss;
+        ss << "inconsistent parameters: n=" << header.ngram_size << ", r=" << header.bucket_size << ", b=" << header.num_buckets << ", num_hash_values=" << header.num_hash_values;
+        message = ss.str();
+        return false;
+    }
+    if (header.fingerprint() && header.byte_per_bucket != 8 && header.byte_per_bucket != 16) {
+        message = "unsupported bucket size: " + std::to_string(header.byte_per_bucket);
+        return false;
+    }
+    return true;
+}
+
+/*
+    Read and write a bucket of byte_per_bucket bytes. A bucket type of a
+    fixed size (e.g., bucket_of<20>) is read directly, and std::string holds
+    a bucket of any other size.
+*/
+template <typename bucket_type>
+inline char *bucket_data(bucket_type& bucket, size_t)
+{
+    return reinterpret_cast<char*>(&bucket);
+}
+
+template <typename bucket_type>
+inline const char *bucket_data(const bucket_type& bucket, size_t)
+{
+    return reinterpret_cast<const char*>(&bucket);
+}
+
+inline char *bucket_data(std::string& bucket, size_t size)
+{
+    bucket.resize(size);
+    return bucket.data();
+}
+
+inline const char *bucket_data(const std::string& bucket, size_t)
+{
+    return bucket.data();
+}
+
+/*
+    Call func with a bucket of the type specialized for byte_per_bucket
+    bytes, so that comparing and copying buckets have constant sizes for
+    the common configurations: fingerprints (8 or 16 bytes) and r = 5, 10,
+    and 20. Other sizes fall back to std::string.
+*/
+template <typename func_type>
+inline int dispatch_bucket(uint32_t byte_per_bucket, func_type func)
+{
+    switch (byte_per_bucket) {
+    case sizeof(fingerprint64_t):
+        return func(fingerprint64_t());
+    case sizeof(fingerprint128_t):
+        return func(fingerprint128_t());
+    case sizeof(bucket_of<5>):
+        return func(bucket_of<5>());
+    case sizeof(bucket_of<10>):
+        return func(bucket_of<10>());
+    case sizeof(bucket_of<20>):
+        return func(bucket_of<20>());
+    default:
+        return func(std::string());
+    }
+}
+
+/*
+    A MinHash file mapped into memory. open() parses the header once and
+    makes sure that the file holds all records, and bucket(i, j) points to
+    the bucket #j of the record #i in place (in either layout), so that the
+    tools read the buckets without a stream.
+*/
+class hash_reader : public mapped_file
+{
+protected:
+    hash_header m_header;
+    size_t m_released = 0;
+
+public:
+    /*
+        Map the MinHash file and read its header. Return false with an
+        error message (including the file name) on failure.
+    */
+    bool open(const std::string& filename)
+    {
+        if (!mapped_file::open(filename)) {
+            return false;
+        }
+
+        std::string message;
+        std::istringstream iss(std::string(m_size ? m_data : "", std::min<size_t>(m_size, 4096)));
+        if (!read_header(iss, m_header, message)) {
+            close();
+            m_error = message + ": " + filename;
+            return false;
+        }
+        if (m_size < m_header.bucket_offset(0, 0) + m_header.record_size() * m_header.num_records) {
+            close();
+            m_error = "the hash file is truncated: " + filename;
+            return false;
+        }
+        return true;
+    }
+
+    const hash_header& header() const
+    {
+        return m_header;
+    }
+
+    uint64_t num_records() const
+    {
+        return m_header.num_records;
+    }
+
+    const char *bucket(uint64_t i, size_t j) const
+    {
+        return m_data + m_header.bucket_offset(i, j);
+    }
+
+    /*
+        Drop the pages of the records before #i (the first record of a
+        block in the column-major layout) from the resident set after
+        reading them sequentially.
+    */
+    void release(uint64_t i)
+    {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t end = (i < m_header.num_records ? m_header.bucket_offset(i, 0) : m_size) / page * page;
+        if (m_data != nullptr && m_released < end) {
+            madvise(const_cast<char*>(m_data) + m_released, end - m_released, MADV_DONTNEED);
+            m_released = end;
+        }
+    }
+};
+
+/*
+    Write records to a MinHash file in the layout of the header. The
+    blocked column-major layout buffers a block of records, and finish()
+    writes the last (possibly shorter) block.
+*/
+class record_writer
+{
+protected:
+    std::ostream& m_os;
+    const hash_header& m_header;
+    std::vector<char> m_buffer;
+    std::vector<char> m_columns;
+    uint64_t m_num = 0;
+
+public:
+    record_writer(std::ostream& os, const hash_header& header) : m_os(os), m_header(header)
+    {
+        m_buffer.resize(static_cast<size_t>(header.block_size) * header.record_size());
+        m_columns.resize(m_buffer.size());
+    }
+
+    void write(const char *record)
+    {
+        if (m_header.block_size == 0) {
+            m_os.write(record, m_header.record_size());
+            return;
+        }
+        std::memcpy(&m_buffer[m_header.record_size() * m_num], record, m_header.record_size());
+        if (++m_num == m_header.block_size) {
+            flush();
+        }
+    }
+
+    void finish()
+    {
+        if (m_num != 0) {
+            flush();
+        }
+    }
+
+protected:
+    void flush()
+    {
+        // Transpose the block into columns of buckets.
+        const size_t bpb = m_header.byte_per_bucket;
+        char *p = m_columns.data();
+        for (size_t j = 0; j < m_header.num_buckets; ++j) {
+            for (uint64_t k = 0; k < m_num; ++k, p += bpb) {
+                std::memcpy(p, &m_buffer[m_header.record_size() * k + bpb * j], bpb);
+            }
+        }
+        m_os.write(m_columns.data(), p - m_columns.data());
+        m_num = 0;
+    }
+};
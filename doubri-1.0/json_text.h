@@ -0,0 +1,371 @@
+/*
+    Extract the "text" field from a JSON line without building a DOM.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utf8.h>
+
+/*
+    A scanner that validates a JSON line, skips every value except the one
+    of the top-level key "text", and unescapes that string into a buffer.
+
+    The scanner gives up (returns false) on anything it does not handle in
+    the same way as nlohmann::json: malformed JSON, duplicated "text" keys,
+    escaped keys, invalid surrogates and UTF-8 sequences, deep nesting, and
+    a "text" value that is not a string. The caller should then parse the
+    line with nlohmann::json, which reports the error or handles the case.
+*/
+class json_text_scanner
+{
+protected:
+    const char *m_p;
+    const char *m_end;
+    int m_depth;
+
+    static const int max_depth = 256;
+
+public:
+    /*
+        Store the value of the top-level "text" key into text and return
+        true, or return false to request the fallback to the full parser.
+    */
+    bool extract(std::string_view line, std::string& text)
+    {
+        m_p = line.data();
+        m_end = line.data() + line.size();
+        m_depth = 0;
+
+        bool found = false;
+        text.clear();
+
+        skip_ws();
+        if (!consume('{')) {
+            return false;
+        }
+        skip_ws();
+        if (!consume('}')) {
+            for (;;) {
+                // Read a key.
+                const char *key = m_p + 1;
+                if (!skip_string()) {
+                    return false;
+                }
+                std::string_view name(key, m_p - key - 1);
+                if (name.find('\\') != std::string_view::npos) {
+                    return false;
+                }
+
+                skip_ws();
+                if (!consume(':')) {
+                    return false;
+                }
+                skip_ws();
+
+                // Read (or skip) the value.
+                if (name == "text") {
+                    if (found || !read_string(text)) {
+                        return false;
+                    }
+                    found = true;
+                } else if (!skip_value()) {
+                    return false;
+                }
+
+                skip_ws();
+                if (consume(',')) {
+                    skip_ws();
+                    continue;
+                } else if (consume('}')) {
+                    break;
+                }
+                return false;
+            }
+        }
+
+        // Nothing but whitespace may follow the object.
+        skip_ws();
+        return found && m_p == m_end;
+    }
+
+protected:
+    bool consume(char c)
+    {
+        if (m_p != m_end && *m_p == c) {
+            ++m_p;
+            return true;
+        }
+        return false;
+    }
+
+    void skip_ws()
+    {
+        while (m_p != m_end && (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r')) {
+            ++m_p;
+        }
+    }
+
+    static int hex(char c)
+    {
+        if ('0' <= c && c <= '9') {
+            return c - '0';
+        } else if ('a' <= c && c <= 'f') {
+            return c - 'a' + 10;
+        } else if ('A' <= c && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    /*
+        Read four hexadecimal digits after "\u".
+    */
+    bool read_hex4(uint32_t& cp)
+    {
+        if (m_end - m_p < 4) {
+            return false;
+        }
+        cp = 0;
+        for (int i = 0; i < 4; ++i) {
+            const int v = hex(*m_p++);
+            if (v < 0) {
+                return false;
+            }
+            cp = (cp << 4) | v;
+        }
+        return true;
+    }
+
+    /*
+        Read "\uXXXX" (or a surrogate pair "\uXXXX\uXXXX") after "\u".
+    */
+    bool read_unicode(uint32_t& cp)
+    {
+        if (!read_hex4(cp)) {
+            return false;
+        }
+        if (0xDC00 <= cp && cp <= 0xDFFF) {
+            return false;
+        }
+        if (0xD800 <= cp && cp <= 0xDBFF) {
+            uint32_t low;
+            if (!consume('\\') || !consume('u') || !read_hex4(low)) {
+                return false;
+            }
+            if (low < 0xDC00 || 0xDFFF < low) {
+                return false;
+            }
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        }
+        return true;
+    }
+
+    /*
+        Scan a string starting at the double quote. When out is not null,
+        append the unescaped string to out.
+    */
+    bool scan_string(std::string *out)
+    {
+        if (!consume('"')) {
+            return false;
+        }
+        const char *begin = m_p;
+        unsigned char bits = 0;
+        for (;;) {
+            // Find the run of characters that need no unescaping.
+            const char *q = m_p;
+            for (; q != m_end; ++q) {
+                const unsigned char c = static_cast<unsigned char>(*q);
+                if (c == '"' || c == '\\' || c < 0x20) {
+                    break;
+                }
+                bits |= c;
+            }
+            if (out) {
+                out->append(m_p, q);
+            }
+            m_p = q;
+
+            if (m_p == m_end || static_cast<unsigned char>(*m_p) < 0x20) {
+                return false;
+            } else if (*m_p == '"') {
+                break;
+            }
+
+            // An escape sequence.
+            ++m_p;
+            if (m_p == m_end) {
+                return false;
+            }
+            const char c = *m_p++;
+            char e = 0;
+            switch (c) {
+            case '"': e = '"'; break;
+            case '\\': e = '\\'; break;
+            case '/': e = '/'; break;
+            case 'b': e = '\b'; break;
+            case 'f': e = '\f'; break;
+            case 'n': e = '\n'; break;
+            case 'r': e = '\r'; break;
+            case 't': e = '\t'; break;
+            case 'u':
+                {
+                    uint32_t cp;
+                    if (!read_unicode(cp)) {
+                        return false;
+                    }
+                    if (out) {
+                        utf8::append(cp, std::back_inserter(*out));
+                    }
+                }
+                continue;
+            default:
+                return false;
+            }
+            if (out) {
+                out->push_back(e);
+            }
+        }
+
+        // Validate UTF-8 sequences (nlohmann::json rejects invalid ones).
+        if ((bits & 0x80) && !utf8::is_valid(begin, m_p)) {
+            return false;
+        }
+        ++m_p;
+        return true;
+    }
+
+    bool skip_string()
+    {
+        return scan_string(nullptr);
+    }
+
+    bool read_string(std::string& text)
+    {
+        return scan_string(&text);
+    }
+
+    bool skip_digits()
+    {
+        const char *begin = m_p;
+        while (m_p != m_end && '0' <= *m_p && *m_p <= '9') {
+            ++m_p;
+        }
+        return m_p != begin;
+    }
+
+    bool skip_number()
+    {
+        consume('-');
+        if (consume('0')) {
+            // No leading zeros.
+        } else if (m_p != m_end && '1' <= *m_p && *m_p <= '9') {
+            skip_digits();
+        } else {
+            return false;
+        }
+        if (consume('.') && !skip_digits()) {
+            return false;
+        }
+        if (consume('e') || consume('E')) {
+            if (!consume('+')) {
+                consume('-');
+            }
+            if (!skip_digits()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool skip_literal(std::string_view literal)
+    {
+        if (static_cast<size_t>(m_end - m_p) < literal.size() || std::string_view(m_p, literal.size()) != literal) {
+            return false;
+        }
+        m_p += literal.size();
+        return true;
+    }
+
+    bool skip_container(char close)
+    {
+        if (++m_depth > max_depth) {
+            return false;
+        }
+        ++m_p;
+        skip_ws();
+        if (!consume(close)) {
+            for (;;) {
+                if (close == '}') {
+                    if (!skip_string()) {
+                        return false;
+                    }
+                    skip_ws();
+                    if (!consume(':')) {
+                        return false;
+                    }
+                    skip_ws();
+                }
+                if (!skip_value()) {
+                    return false;
+                }
+                skip_ws();
+                if (consume(',')) {
+                    skip_ws();
+                    continue;
+                } else if (consume(close)) {
+                    break;
+                }
+                return false;
+            }
+        }
+        --m_depth;
+        return true;
+    }
+
+    bool skip_value()
+    {
+        if (m_p == m_end) {
+            return false;
+        }
+        switch (*m_p) {
+        case '"':
+            return skip_string();
+        case '{':
+            return skip_container('}');
+        case '[':
+            return skip_container(']');
+        case 't':
+            return skip_literal("true");
+        case 'f':
+            return skip_literal("false");
+        case 'n':
+            return skip_literal("null");
+        default:
+            return skip_number();
+        }
+    }
+};
@@ -0,0 +1,169 @@
+/*
+    Read-only memory-mapped file.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+    A file mapped into memory for reading.
+*/
+class mapped_file
+{
+protected:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    std::string m_error;
+
+public:
+    mapped_file()
+    {
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    virtual ~mapped_file()
+    {
+        close();
+    }
+
+    /*
+        Map the file into memory. Return false with an error message on
+        failure. An empty file is mapped to an empty range.
+    */
+    bool open(const std::string& filename)
+    {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            m_error = std::string("failed to open ") + filename + ": " + std::strerror(errno);
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            m_error = std::string("failed to stat ") + filename + ": " + std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+
+        if (st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                m_error = std::string("failed to map ") + filename + ": " + std::strerror(errno);
+                ::close(fd);
+                return false;
+            }
+            m_data = static_cast<const char*>(p);
+            m_size = st.st_size;
+        }
+        ::close(fd);
+        return true;
+    }
+
+    void close()
+    {
+        if (m_data != nullptr) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    /*
+        Give the kernel a hint on the access pattern (e.g., MADV_SEQUENTIAL).
+    */
+    void advise(int advice) const
+    {
+        if (m_data != nullptr) {
+            madvise(const_cast<char*>(m_data), m_size, advice);
+        }
+    }
+
+    const char *data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    const std::string& error() const
+    {
+        return m_error;
+    }
+};
+
+/*
+    A line reader of a memory-mapped text file. The lines are views of the
+    mapped memory and stay valid while the mapped_file is open.
+
+    Like std::getline() followed by a check of eof(), getline() ignores the
+    last line when it does not end with a newline.
+*/
+class mapped_line_reader
+{
+protected:
+    const char *m_p;
+    const char *m_end;
+    std::string m_error;
+
+public:
+    // getline() returns views that remain valid after the next call.
+    static const bool stable_lines = true;
+
+    mapped_line_reader(const mapped_file& file)
+        : m_p(file.data()), m_end(file.data() + file.size())
+    {
+    }
+
+    bool getline(std::string_view& line)
+    {
+        // memchr() of glibc scans the memory with SIMD instructions.
+        const void *p = (m_p != m_end) ? std::memchr(m_p, '\n', m_end - m_p) : nullptr;
+        if (p == nullptr) {
+            m_p = m_end;
+            return false;
+        }
+        const char *eol = static_cast<const char*>(p);
+        line = std::string_view(m_p, eol - m_p);
+        m_p = eol + 1;
+        return true;
+    }
+
+    const std::string& error() const
+    {
+        return m_error;
+    }
+};
@@ -22,98 +22,908 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
+#include <sys/stat.h>
 #include <utf8.h>
 #include <nlohmann/json.hpp>
+#include "bounded_queue.h"
+#include "compressed_stream.h"
+#include "content_set.h"
+#include "hashfile.h"
+#include "json_text.h"
+#include "mapped_file.h"
 #include "minhash.h"
+#include "signature_cache.h"
 
 using json = nlohmann::json;
 
-int main(int argc, char *argv[])
+/*
+    Settings of MinHash computation shared by worker threads.
+*/
+struct minhash_context {
+    size_t n = NGRAM_SIZE;
+    size_t bucket_size = BUCKET_SIZE;
+    size_t num_buckets = NUM_BUCKETS;
+    size_t num_hash_values = BUCKET_SIZE * NUM_BUCKETS;
+    int feature = FEATURE_BYTES;
+    signature_engine se;
+    bool dedup = true;
+    uint64_t self_check = 0;
+    size_t byte_per_bucket = 0;     // 0 for raw buckets (4r bytes).
+    bool content = false;           // Compute content fingerprints.
+    signature_cache *cache = nullptr;
+    size_t chunk_size = 1 << 20;    // Bytes of a piece of a large text (0 for none).
+    size_t max_shingles = 0;        // Sample the n-grams beyond this (0 for none).
+
+    /*
+        The number of bytes of a record in the output.
+    */
+    size_t record_size() const
+    {
+        return byte_per_bucket * num_buckets;
+    }
+};
+
+/*
+    Statistics of shingles (n-grams).
+*/
+struct minhash_stats {
+    uint64_t num_shingles = 0;
+    uint64_t num_unique_shingles = 0;
+    uint64_t num_cache_hits = 0;
+    uint64_t num_chunked = 0;
+    uint64_t num_capped = 0;
+
+    void add(const minhash_stats& other)
+    {
+        num_shingles += other.num_shingles;
+        num_unique_shingles += other.num_unique_shingles;
+        num_cache_hits += other.num_cache_hits;
+        num_chunked += other.num_chunked;
+        num_capped += other.num_capped;
+    }
+};
+
+/*
+    Buffers of a thread, reused for all records.
+*/
+struct minhash_buffer {
+    std::vector<const char *> cs;
+    std::string text;
+    json_text_scanner scanner;
+    std::vector<uint32_t> cps;
+    std::vector<uint64_t> xs;
+    shingle_set set;
+    std::vector<std::string_view> unique;
+    std::vector<uint32_t> values;
+    signature_state state;
+    minhash_stats stats;
+};
+
+/*
+    Extract the text of a JSON line into buf.text, parsing the line in JSON
+    only when the scanner cannot extract the text by itself. Throw an
+    exception when the line is broken.
+*/
+void extract_text(std::string_view line, minhash_buffer& buf)
 {
-    size_t n = 5;
-    uint64_t num_records = 0;
-    const uint64_t num_hash_values = 800; // (b, r) = (20, 40)
-    const uint8_t byte_per_hash = (int8_t)4; // 32 bit.
-    std::istream& is = std::cin;
-    std::ostream& os = std::cout;
-    std::ostream& es = std::cerr;
+    std::string& text = buf.text;
+    if (!buf.scanner.extract(line, text)) {
+        auto d = json::parse(line);
+        if (!d.contains("text")) {
+            throw std::runtime_error("the line does not include 'text' key.");
+        }
+        text = d["text"];
+    }
+}
 
-    // Open the output file.
-    std::ofstream ofs(argv[1], std::ios::binary);
-    if (ofs.fail()) {
-        es << "ERROR: failed to open " << argv[1] << std::endl;
-        return 1;
+/*
+    The sampling mask of a document with num n-grams (0 for all n-grams),
+    counting the documents beyond the cap.
+*/
+uint64_t sampling(const minhash_context& ctx, size_t num, minhash_buffer& buf)
+{
+    if (ctx.max_shingles == 0 || num <= ctx.max_shingles) {
+        return 0;
+    }
+    ++buf.stats.num_capped;
+    return sampling_mask(num, ctx.max_shingles);
+}
+
+/*
+    Update the MinHash values with the base hash values of n-grams in
+    buf.xs, keeping the n-grams of the sampling mask.
+*/
+void update_hashes(const minhash_context& ctx, uint64_t mask, minhash_buffer& buf, uint32_t *output)
+{
+    if (mask) {
+        sample_hashes(buf.xs, mask);
+    }
+    if (ctx.dedup) {
+        unique_hashes(buf.xs, buf.set);
+    }
+    buf.stats.num_unique_shingles += buf.xs.size();
+    ctx.se.update(buf.xs.data(), buf.xs.size(), output, buf.state);
+}
+
+/*
+    Update the MinHash values with the n-grams, hashing every distinct
+    n-gram of the sampling mask only once.
+*/
+void update_ngrams(const minhash_context& ctx, const ngram_view& features, uint64_t mask, minhash_buffer& buf, uint32_t *output)
+{
+    if (ctx.se.hash_once()) {
+        buf.xs = base_hashes(features);
+        update_hashes(ctx, mask, buf, output);
+    } else if (!ctx.dedup && !mask) {
+        buf.stats.num_unique_shingles += features.size();
+        ctx.se.update(features, output, buf.state);
+    } else {
+        if (ctx.dedup) {
+            unique_ngrams(features, buf.set, buf.unique, mask);
+        } else {
+            sample_ngrams(features, buf.unique, mask);
+        }
+        buf.stats.num_unique_shingles += buf.unique.size();
+        ctx.se.update(buf.unique, output, buf.state);
+    }
+}
+
+/*
+    Compute MinHash values of a large text in buf.text piece by piece, so
+    that the buffers of a thread do not grow with the text. A piece has
+    about ctx.chunk_size bytes (ending at a letter) followed by the n-1
+    letters of the next piece, and contributes the n-grams starting at its
+    own letters. The MinHash values are the same as the ones computed from
+    the whole text, but num_unique_shingles counts the distinct n-grams of
+    every piece. The text must not include a NUL character.
+*/
+void compute_chunked(const minhash_context& ctx, minhash_buffer& buf, uint32_t *output)
+{
+    const std::string_view text(buf.text);
+    const char *end = text.data() + text.size();
+    ++buf.stats.num_chunked;
+
+    uint64_t mask = 0;
+    if (ctx.max_shingles) {
+        const size_t num_letters = count_letters(text);
+        mask = sampling(ctx, num_letters >= ctx.n ? num_letters - ctx.n + 1 : 0, buf);
+    }
+
+    ctx.se.begin(output, buf.state);
+    for (const char *p = text.data(); p != end; ) {
+        const char *q = skip_letters(p + std::min<size_t>(ctx.chunk_size, end - p) - 1, end, 1);
+        const char *r = skip_letters(q, end, ctx.n - 1);
+        const std::string_view piece(p, r - p);
+        const size_t limit = count_letters(std::string_view(p, q - p));
+
+        if (ctx.feature == FEATURE_ROLLING) {
+            decode(piece, buf.cps);
+            rolling_hashes(buf.cps, ctx.n, buf.xs);
+            buf.xs.resize(std::min(buf.xs.size(), limit));
+            buf.stats.num_shingles += buf.xs.size();
+            update_hashes(ctx, mask, buf, output);
+        } else {
+            find_letters(piece, buf.cs);
+            const ngram_view all = ngram_of_letters(piece, ctx.n, buf.cs);
+            const ngram_view features(buf.cs.data(), std::min(all.size(), limit), ctx.n);
+            buf.stats.num_shingles += features.size();
+            update_ngrams(ctx, features, mask, buf, output);
+        }
+        p = q;
+    }
+    ctx.se.end(output, buf.state);
+}
+
+/*
+    Compute MinHash values of the record #index from its text in buf.text.
+*/
+void compute(const minhash_context& ctx, uint64_t index, minhash_buffer& buf, uint32_t *output)
+{
+    std::string& text = buf.text;
+
+    // Compute a large text in pieces (a text longer than 4n bytes has at
+    // least n letters).
+    const bool large = ctx.chunk_size && text.size() > std::max(ctx.chunk_size, 4 * ctx.n);
+    if (large && std::memchr(text.data(), 0, text.size()) == nullptr) {
+        compute_chunked(ctx, buf, output);
+        return;
+    }
+
+    // The rolling hash decodes the text only once, which also counts the
+    // letters for the same fallback to "EMPTY" as below.
+    ctx.se.begin(output, buf.state);
+    if (ctx.feature == FEATURE_ROLLING) {
+        if (decode(text, buf.cps) < ctx.n) {
+            decode("EMPTY", buf.cps);
+        }
+        rolling_hashes(buf.cps, ctx.n, buf.xs);
+        buf.stats.num_shingles += buf.xs.size();
+        update_hashes(ctx, sampling(ctx, buf.xs.size(), buf), buf, output);
+        ctx.se.end(output, buf.state);
+        return;
+    }
+
+    // Find the letters of the text (which also validates the text), and
+    // make sure that the text is at least n characters.
+    if (find_letters(text, buf.cs) < ctx.n) {
+        text = "EMPTY";
+        find_letters(text, buf.cs);
+    }
+
+    // Obtain features (n-grams) from the text.
+    ngram_view features = ngram_of_letters(text, ctx.n, buf.cs);
+
+    // Compute min-hash values, hashing every distinct n-gram only once.
+    buf.stats.num_shingles += features.size();
+    const uint64_t mask = sampling(ctx, features.size(), buf);
+    update_ngrams(ctx, features, mask, buf, output);
+    ctx.se.end(output, buf.state);
+
+    // Compare the values with the ones from the scalar kernel (without
+    // removing duplicated n-grams or sampling them).
+    const bool optimized = ctx.se.kernel != KERNEL_SCALAR || ctx.dedup;
+    if (ctx.self_check && index % ctx.self_check == 0 && ctx.se.engine == ENGINE_MURMUR32 && optimized && !mask) {
+        std::vector<uint32_t> expected(ctx.num_hash_values);
+        minhash_scalar(features, expected.data(), ctx.num_hash_values);
+        if (std::memcmp(output, expected.data(), sizeof(uint32_t) * ctx.num_hash_values) != 0) {
+            throw std::runtime_error("self-check failed");
+        }
+    }
+}
+
+/*
+    Compute the record of #index from its JSON line: the MinHash values, or
+    the fingerprints of the buckets when the context requests them. Store
+    the content fingerprint of the text when content is not null. Throw an
+    exception when the line is broken.
+
+    With the signature cache, a record of the same text computed before is
+    copied from the cache without computing MinHash values.
+*/
+void compute_record(const minhash_context& ctx, std::string_view line, uint64_t index, minhash_buffer& buf, char *record, fingerprint128_t *content)
+{
+    extract_text(line, buf);
+
+    // The fingerprint of the text as is (before the fallback to "EMPTY").
+    fingerprint128_t fp;
+    if (content != nullptr || ctx.cache != nullptr) {
+        MurmurHash3_x64_128(buf.text.data(), buf.text.size(), 0, fp.data());
+        if (content != nullptr) {
+            *content = fp;
+        }
+        if (ctx.cache != nullptr && ctx.cache->find(fp, record)) {
+            ++buf.stats.num_cache_hits;
+            return;
+        }
+    }
+
+    if (ctx.byte_per_bucket == BYTE_PER_HASH * ctx.bucket_size) {
+        compute(ctx, index, buf, reinterpret_cast<uint32_t*>(record));
+    } else {
+        buf.values.resize(ctx.num_hash_values);
+        compute(ctx, index, buf, buf.values.data());
+        fingerprint_buckets(buf.values.data(), ctx.num_buckets, ctx.bucket_size, ctx.byte_per_bucket, reinterpret_cast<uint8_t*>(record));
     }
 
-    // Write the header: "MinHash"4
-    ofs << "MinHash";
-    ofs.write(reinterpret_cast<const char*>(&byte_per_hash), sizeof(byte_per_hash));
-    
-    // Reserve the slot to write the number of records.
-    auto pos = ofs.tellp();
-    ofs.write(reinterpret_cast<const char*>(&num_records), sizeof(num_records));
-    
-    // Write the number of hash values per record.
-    ofs.write(reinterpret_cast<const char*>(&num_hash_values), sizeof(num_hash_values));
+    if (ctx.cache != nullptr) {
+        ctx.cache->insert(fp, record);
+    }
+}
+
+/*
+    Compute MinHash values of the records one by one.
+    The reader is either line_reader or mapped_line_reader.
+*/
+template <typename reader_type>
+int run_sequential(const minhash_context& ctx, reader_type& reader, record_writer& writer, std::ostream& cfs, uint64_t& num_records, minhash_stats& stats, std::ostream& es)
+{
+    minhash_buffer buf;
+    std::vector<char> record(ctx.record_size());
+    fingerprint128_t content;
+    std::string_view line;
 
     // One JSON object per line.
     for (num_records = 0; ; ++num_records) {
         // Read a line from STDIN.
-        std::string line;
-        std::getline(is, line);
-        if (is.eof()) {
+        if (!reader.getline(line)) {
             break;
         }
 
-        // Parse the line in JSON.
-        auto d = json::parse(line);
+        try {
+            compute_record(ctx, line, num_records, buf, record.data(), ctx.content ? &content : nullptr);
+        } catch (const std::exception& e) {
+            es << "ERROR: " << e.what() << " (line " << num_records + 1 << ")" << std::endl;
+            return 1;
+        }
 
-        // Obtain the text.
-        if (d.contains("text")) {
-            std::string text = d["text"];
+        // Write the hash values (and the content fingerprint).
+        writer.write(record.data());
+        if (ctx.content) {
+            cfs.write(reinterpret_cast<const char*>(content.data()), sizeof(content));
+        }
+    }
 
-	    // Make sure that the text is at least n characters.
-	    if (utf8::distance(text.begin(), text.end()) < n) {
-	      text = "EMPTY";
-	    }
+    if (!reader.error().empty()) {
+        es << "ERROR: " << reader.error() << std::endl;
+        return 1;
+    }
+    stats.add(buf.stats);
+    return 0;
+}
 
-            // Obtain features (n-grams) from the text.
-            std::vector<std::string> features;
-            ngram(text, features, n);
+/*
+    A batch of consecutive records handed to a worker thread.
+*/
+struct batch {
+    uint64_t first = 0;
+    std::vector<std::string_view> lines;
+    std::vector<std::string> storage;   // Copies of the lines when necessary.
+    std::vector<char> records;
+    std::vector<fingerprint128_t> contents;
+    uint64_t error_index = 0;
+    std::string error;
+    std::promise<void> done;
+};
 
-            // Compute min-hash values.
-            uint32_t buffer[num_hash_values];
-            minhash(features, buffer, num_hash_values);
+/*
+    Compute MinHash values with a reader thread, num_threads worker threads,
+    and the writer (this thread). The writer receives batches in the input
+    order through a bounded queue, which also caps the number of batches in
+    memory regardless of the input size.
 
-            // Write the hash values.
-            ofs.write(reinterpret_cast<const char*>(buffer), sizeof(buffer));
+    A batch refers to the lines of a memory-mapped file without copying
+    them, so the reader only needs to find newlines in the file.
+*/
+template <typename reader_type>
+int run_parallel(const minhash_context& ctx, size_t num_threads, reader_type& reader, record_writer& writer, std::ostream& cfs, uint64_t& num_records, minhash_stats& stats, std::ostream& es)
+{
+    const size_t batch_size = 64;
+    const size_t capacity = 4 * num_threads;
+    bounded_queue<std::shared_ptr<batch> > tasks(capacity);
+    bounded_queue<std::shared_ptr<batch> > order(capacity);
+
+    // The reader.
+    std::thread reading([&] {
+        for (uint64_t first = 0; ; first += batch_size) {
+            auto b = std::make_shared<batch>();
+            b->first = first;
+            b->storage.reserve(reader_type::stable_lines ? 0 : batch_size);
+            for (size_t i = 0; i < batch_size; ++i) {
+                std::string_view line;
+                if (!reader.getline(line)) {
+                    break;
+                }
+                if (!reader_type::stable_lines) {
+                    b->storage.emplace_back(line);
+                    line = b->storage.back();
+                }
+                b->lines.push_back(line);
+            }
+            if (b->lines.empty()) {
+                break;
+            }
+            if (!order.push(b) || !tasks.push(b)) {
+                break;
+            }
+            if (b->lines.size() < batch_size) {
+                break;
+            }
+        }
+        tasks.close();
+        order.close();
+    });
 
-#if 0
-            for (uint64_t i = 0; i < num_hash_values; ++i) {
-                os << std::dec << "hash[" << num_records << "][" << i << "]: ";
-                for (uint8_t j = 0; j < byte_per_hash; ++j) {
-                    os << std::setfill('0') << std::setw(2) << std::hex << (unsigned int)reinterpret_cast<unsigned char*>(&buffer)[i*byte_per_hash+j];
+    // The workers.
+    std::vector<std::thread> workers;
+    std::vector<minhash_buffer> buffers(num_threads);
+    for (size_t t = 0; t < num_threads; ++t) {
+        workers.emplace_back([&, t] {
+            minhash_buffer& buf = buffers[t];
+            std::shared_ptr<batch> b;
+            while (tasks.pop(b)) {
+                const size_t record_size = ctx.record_size();
+                b->records.resize(b->lines.size() * record_size);
+                b->contents.resize(ctx.content ? b->lines.size() : 0);
+                for (size_t i = 0; i < b->lines.size(); ++i) {
+                    try {
+                        compute_record(ctx, b->lines[i], b->first + i, buf, &b->records[i * record_size], ctx.content ? &b->contents[i] : nullptr);
+                    } catch (const std::exception& e) {
+                        b->error_index = b->first + i;
+                        b->error = e.what();
+                        break;
+                    }
                 }
-                os << std::endl;
+                b->done.set_value();
             }
-#endif
+        });
+    }
+
+    // The writer.
+    int ret = 0;
+    std::shared_ptr<batch> b;
+    for (num_records = 0; order.pop(b); ) {
+        b->done.get_future().wait();
+        if (!b->error.empty()) {
+            es << "ERROR: " << b->error << " (line " << b->error_index + 1 << ")" << std::endl;
+            ret = 1;
+            break;
+        }
+        for (size_t i = 0; i < b->lines.size(); ++i) {
+            writer.write(&b->records[i * ctx.record_size()]);
+        }
+        if (ctx.content) {
+            cfs.write(reinterpret_cast<const char*>(b->contents.data()), sizeof(fingerprint128_t) * b->contents.size());
+        }
+        num_records += b->lines.size();
+    }
+
+    // Stop the threads (they stop immediately when an error occurred).
+    order.abort();
+    tasks.abort();
+    reading.join();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (ret == 0 && !reader.error().empty()) {
+        es << "ERROR: " << reader.error() << std::endl;
+        ret = 1;
+    }
+    for (const auto& buf : buffers) {
+        stats.add(buf.stats);
+    }
+    return ret;
+}
+
+template <typename reader_type>
+int run(const minhash_context& ctx, size_t num_threads, reader_type& reader, record_writer& writer, std::ostream& cfs, uint64_t& num_records, minhash_stats& stats, std::ostream& es)
+{
+    return (num_threads <= 1) ?
+        run_sequential(ctx, reader, writer, cfs, num_records, stats, es) :
+        run_parallel(ctx, num_threads, reader, writer, cfs, num_records, stats, es);
+}
+
+/*
+    Compute MinHash values of the documents in input_filename (or STDIN if
+    it is null) and write them to output_filename with the header. Report
+    the statistics to os in a JSON line.
+*/
+int process(const minhash_context& ctx, hash_header header, size_t num_threads, const char *output_filename, const char *input_filename, std::ostream& os, std::ostream& es)
+{
+    // Map the input file into memory (unless it is compressed).
+    mapped_file input;
+    std::ifstream ifs;
+    bool mapped = false;
+    if (input_filename != nullptr) {
+        if (!input.open(input_filename)) {
+            es << "ERROR: " << input.error() << std::endl;
+            return 1;
+        }
+        const std::string head(input.data(), std::min<size_t>(input.size(), 4));
+        if (detect_format(head) == FORMAT_PLAIN) {
+            input.advise(MADV_SEQUENTIAL);
+            mapped = true;
         } else {
-            es << "ERROR: the line does not include 'text' key." << std::endl;
+            input.close();
+            ifs.open(input_filename, std::ios::binary);
+            if (ifs.fail()) {
+                es << "ERROR: failed to open " << input_filename << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // Open the output file.
+    std::ofstream ofs(output_filename, std::ios::binary);
+    if (ofs.fail()) {
+        es << "ERROR: failed to open " << output_filename << std::endl;
+        return 1;
+    }
+
+    // Open the file of content fingerprints, or remove the one of a previous
+    // run, which does not match the new records.
+    std::ofstream cfs;
+    const std::string content_filename = std::string(output_filename) + CONTENT_SUFFIX;
+    if (ctx.content) {
+        cfs.open(content_filename, std::ios::binary);
+        if (cfs.fail()) {
+            es << "ERROR: failed to open " << content_filename << std::endl;
             return 1;
         }
+    } else if (std::remove(content_filename.c_str()) != 0 && errno != ENOENT) {
+        es << "ERROR: failed to remove " << content_filename << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    // Write the header (the number of records is updated at the end).
+    write_header(ofs, header);
+
+    // Compute MinHash values of the records (decompressing the input if necessary).
+    record_writer writer(ofs, header);
+    uint64_t num_records = 0;
+    int ret = 0;
+    minhash_stats stats;
+    if (mapped) {
+        mapped_line_reader reader(input);
+        ret = run(ctx, num_threads, reader, writer, cfs, num_records, stats, es);
+    } else {
+        line_reader reader(input_filename != nullptr ? ifs : std::cin);
+        ret = run(ctx, num_threads, reader, writer, cfs, num_records, stats, es);
     }
+    if (ret != 0) {
+        return ret;
+    }
+    writer.finish();
 
     // Write the number of records in the header.
-    ofs.seekp(pos);
-    ofs.write(reinterpret_cast<const char*>(&num_records), sizeof(num_records));
+    header.num_records = num_records;
+    ofs.seekp(0);
+    write_header(ofs, header);
     ofs.close();
 
+    // Report the statistics of shingles in a line. The shingles of the
+    // records copied from the cache are not extracted, so the statistics
+    // of shingles are left out with the cache.
+    std::stringstream ss;
+    ss << '{' <<
+        kv("target", output_filename) << ", " <<
+        kv("num_records", num_records);
+    if (ctx.cache != nullptr) {
+        ss << ", " << kv("num_cache_hits", stats.num_cache_hits);
+    } else {
+        ss << ", " <<
+            kv("num_shingles", stats.num_shingles) << ", " <<
+            kv("num_unique_shingles", stats.num_unique_shingles) << ", " <<
+            kv("unique_rate", stats.num_shingles ? stats.num_unique_shingles / (double)stats.num_shingles : 1.);
+    }
+    if (stats.num_chunked) {
+        ss << ", " << kv("num_chunked", stats.num_chunked);
+    }
+    if (ctx.max_shingles) {
+        ss << ", " << kv("num_capped", stats.num_capped);
+    }
+    ss << '}' << std::endl;
+    os << ss.str() << std::flush;
+
     return 0;
 }
+
+/*
+    A pair of the output and input files in the manifest.
+*/
+struct minhash_job {
+    std::string output_filename;
+    std::string input_filename;
+    uint64_t size = 0;
+};
+
+/*
+    Process the pairs of files listed in the manifest (one pair of
+    "MINHASH_FILE JSONL_FILE" per line, separated by a tab or a space) with
+    num_threads worker threads shared by all files. A worker processes one
+    file at a time, taking the largest remaining input first so that a
+    large file does not start last. The statistics of a file are reported
+    when it finishes.
+*/
+int process_manifest(const minhash_context& ctx, const hash_header& header, size_t num_threads, std::istream& manifest, std::ostream& os, std::ostream& es)
+{
+    // Read the manifest.
+    std::vector<minhash_job> jobs;
+    for (std::string line; std::getline(manifest, line); ) {
+        if (line.empty()) {
+            continue;
+        }
+        size_t pos = line.find('\t');
+        pos = (pos != std::string::npos) ? pos : line.find(' ');
+        if (pos == std::string::npos) {
+            es << "ERROR: a line of the manifest must be MINHASH_FILE and JSONL_FILE: " << line << std::endl;
+            return 1;
+        }
+        minhash_job job;
+        job.output_filename = line.substr(0, pos);
+        job.input_filename = line.substr(pos + 1);
+        struct stat st;
+        if (stat(job.input_filename.c_str(), &st) == 0) {
+            job.size = st.st_size;
+        }
+        jobs.push_back(job);
+    }
+
+    // Schedule the largest inputs first.
+    std::stable_sort(jobs.begin(), jobs.end(), [](const minhash_job& x, const minhash_job& y) {
+        return x.size > y.size;
+    });
+
+    // Process the files, writing the messages of a file at once.
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> num_failures(0);
+    std::mutex mutex;
+    auto work = [&] {
+        for (size_t k; (k = next++) < jobs.size(); ) {
+            std::stringstream jos, jes;
+            const int ret = process(ctx, header, 1, jobs[k].output_filename.c_str(), jobs[k].input_filename.c_str(), jos, jes);
+            num_failures += (ret != 0);
+            std::lock_guard<std::mutex> lock(mutex);
+            os << jos.str() << std::flush;
+            es << jes.str() << std::flush;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < std::min(num_threads, jobs.size()); ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return num_failures ? 1 : 0;
+}
+
+void usage(std::ostream& os, const char *argv0)
+{
+    os << "USAGE: " << argv0 << " [OPTIONS] MINHASH_FILE [JSONL_FILE]" << std::endl;
+    os << "       " << argv0 << " [OPTIONS] --manifest FILE" << std::endl;
+    os << "Read JSONL documents from JSONL_FILE (or STDIN) and write their MinHash buckets" << std::endl;
+    os << "to MINHASH_FILE. The documents may be compressed by gzip or zstd (detected" << std::endl;
+    os << "automatically). A plain JSONL_FILE is read through a memory map." << std::endl;
+    os << std::endl;
+    os << "OPTIONS:" << std::endl;
+    os << "    -n N               the number of letters of an n-gram (default: 5)" << std::endl;
+    os << "    -b B               the number of buckets (default: 40)" << std::endl;
+    os << "    -r R               the number of hash values in a bucket (default: 20)" << std::endl;
+    os << "    --engine NAME      signature engine: murmur32 (default), murmur128, permute, oph" << std::endl;
+    os << "    --seed N           seed of the permutations (permute, oph)" << std::endl;
+    os << "    --feature NAME     base hash of n-grams for permute and oph: bytes (default)," << std::endl;
+    os << "                       rolling (polynomial hash of code points)" << std::endl;
+    os << "    --kernel NAME      hash kernel: auto (default), scalar, avx2, avx512" << std::endl;
+    os << "    --self-check N     recompute every N-th record with the scalar kernel and" << std::endl;
+    os << "                       abort if the values differ" << std::endl;
+    os << "    --fingerprint N    store a N-bit fingerprint (64 or 128) of every bucket" << std::endl;
+    os << "                       instead of its MinHash values" << std::endl;
+    os << "    --content          write the 128-bit fingerprint of the text of every record" << std::endl;
+    os << "                       to MINHASH_FILE.content for exact duplicates" << std::endl;
+    os << "    --cache FILE       reuse the records of the same texts in the signature cache" << std::endl;
+    os << "                       FILE (created if it does not exist)" << std::endl;
+    os << "    --cache-size MB    the size of a new signature cache in MB (default: 1024)" << std::endl;
+    os << "    --block N          store the buckets in the blocked column-major layout with" << std::endl;
+    os << "                       N records per block (default: 0, the row-major layout)" << std::endl;
+    os << "    --chunk BYTES      compute a text longer than BYTES in pieces of BYTES bytes" << std::endl;
+    os << "                       (default: 1048576; 0 for computing every text at once)" << std::endl;
+    os << "    --max-shingles N   hash a sample of about N n-grams of a document with more" << std::endl;
+    os << "                       n-grams than N (default: 0, hashing all n-grams)" << std::endl;
+    os << "    --no-dedup         hash every occurrence of an n-gram (for comparison)" << std::endl;
+    os << "    --manifest FILE    process the pairs of MINHASH_FILE and JSONL_FILE listed in" << std::endl;
+    os << "                       FILE (\"-\" for STDIN), one pair per line, largest first" << std::endl;
+    os << "    -j N               compute MinHash values with N worker threads (default: 1);" << std::endl;
+    os << "                       with --manifest, process N files at a time" << std::endl;
+    os << "    -h, --help         show this help message and exit" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    minhash_context ctx;
+    const uint8_t byte_per_hash = (int8_t)4; // 32 bit.
+    int engine = ENGINE_MURMUR32;
+    uint64_t seed = 0;
+    minhash_kernel kernel = KERNEL_AUTO;
+    std::string_view kernel_name = "auto";
+    size_t num_threads = 1;
+    const char *output_filename = nullptr;
+    const char *input_filename = nullptr;
+    const char *cache_filename = nullptr;
+    const char *manifest_filename = nullptr;
+    size_t cache_size = 1024;
+    uint32_t block_size = 0;
+    std::istream& is = std::cin;
+    std::ostream& os = std::cout;
+    std::ostream& es = std::cerr;
+
+    // Report an invalid value of an option.
+    auto invalid = [&](std::string_view arg, const char *value) {
+        es << "ERROR: invalid value for " << arg << ": " << value << std::endl;
+        usage(es, argv[0]);
+        return 1;
+    };
+
+    // Parse the command-line arguments.
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            usage(os, argv[0]);
+            return 0;
+        } else if (arg == "-n" && i + 1 < argc) {
+            if (!parse_number(argv[++i], ctx.n, 1, 1024)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "-b" && i + 1 < argc) {
+            if (!parse_number(argv[++i], ctx.num_buckets, 1, 65536)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "-r" && i + 1 < argc) {
+            if (!parse_number(argv[++i], ctx.bucket_size, 1, 65536)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "--engine" && i + 1 < argc) {
+            std::string_view value(argv[++i]);
+            engine = engine_from_name(value);
+            if (engine < 0) {
+                es << "ERROR: unknown engine: " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--seed" && i + 1 < argc) {
+            if (!parse_number(argv[++i], seed, 0, UINT64_MAX)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "--feature" && i + 1 < argc) {
+            std::string_view value(argv[++i]);
+            ctx.feature = feature_from_name(value);
+            if (ctx.feature < 0) {
+                es << "ERROR: unknown feature: " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--kernel" && i + 1 < argc) {
+            std::string_view value(argv[++i]);
+            kernel_name = value;
+            if (value == "auto") {
+                kernel = KERNEL_AUTO;
+            } else if (value == "scalar") {
+                kernel = KERNEL_SCALAR;
+            } else if (value == "avx2") {
+                kernel = KERNEL_AVX2;
+            } else if (value == "avx512") {
+                kernel = KERNEL_AVX512;
+            } else {
+                es << "ERROR: unknown kernel: " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--self-check" && i + 1 < argc) {
+            if (!parse_number(argv[++i], ctx.self_check, 0, UINT64_MAX)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "--fingerprint" && i + 1 < argc) {
+            std::string_view value(argv[++i]);
+            if (value == "64") {
+                ctx.byte_per_bucket = sizeof(fingerprint64_t);
+            } else if (value == "128") {
+                ctx.byte_per_bucket = sizeof(fingerprint128_t);
+            } else {
+                es << "ERROR: unsupported fingerprint size: " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--content") {
+            ctx.content = true;
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_filename = argv[++i];
+        } else if (arg == "--cache-size" && i + 1 < argc) {
+            if (!parse_number(argv[++i], cache_size, 1, 1 << 30)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "--block" && i + 1 < argc) {
+            if (!parse_number(argv[++i], block_size, 0, UINT32_MAX)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "--manifest" && i + 1 < argc) {
+            manifest_filename = argv[++i];
+        } else if (arg == "--chunk" && i + 1 < argc) {
+            if (!parse_number(argv[++i], ctx.chunk_size, 0, SIZE_MAX)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "--max-shingles" && i + 1 < argc) {
+            if (!parse_number(argv[++i], ctx.max_shingles, 0, SIZE_MAX)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (arg == "--no-dedup") {
+            ctx.dedup = false;
+        } else if (arg == "-j" && i + 1 < argc) {
+            if (!parse_number(argv[++i], num_threads, 1, 1024)) {
+                return invalid(arg, argv[i]);
+            }
+        } else if (!arg.empty() && arg[0] == '-') {
+            es << "ERROR: unknown option: " << arg << std::endl;
+            usage(es, argv[0]);
+            return 1;
+        } else if (output_filename == nullptr) {
+            output_filename = argv[i];
+        } else if (input_filename == nullptr) {
+            input_filename = argv[i];
+        } else {
+            usage(es, argv[0]);
+            return 1;
+        }
+    }
+    if ((output_filename == nullptr) == (manifest_filename == nullptr)) {
+        usage(es, argv[0]);
+        return 1;
+    }
+
+    // Fix the parameters of buckets. A fingerprint must be smaller than the
+    // bucket itself.
+    ctx.num_hash_values = ctx.bucket_size * ctx.num_buckets;
+    if (ctx.num_hash_values > (1 << 20)) {
+        es << "ERROR: too many hash values (b * r): " << ctx.num_hash_values << std::endl;
+        return 1;
+    }
+    if (ctx.byte_per_bucket == 0) {
+        ctx.byte_per_bucket = BYTE_PER_HASH * ctx.bucket_size;
+    } else if (BYTE_PER_HASH * ctx.bucket_size <= ctx.byte_per_bucket) {
+        es << "ERROR: the fingerprint is not smaller than a bucket of " << ctx.bucket_size << " hash values" << std::endl;
+        return 1;
+    }
+
+    // The rolling hash replaces the base hash of the hash-once engines.
+    if (ctx.feature != FEATURE_BYTES && engine != ENGINE_PERMUTE && engine != ENGINE_OPH) {
+        es << "ERROR: the feature " << feature_name(ctx.feature) << " requires the engine permute or oph" << std::endl;
+        return 1;
+    }
+
+    // Make sure that the CPU supports the kernel.
+    kernel = resolve_kernel(kernel);
+    if (kernel == KERNEL_AUTO) {
+        es << "ERROR: the CPU does not support the kernel: " << kernel_name << std::endl;
+        return 1;
+    }
+
+    // Prepare the header. MurmurHash3 engines do not use the seed of the
+    // permutations.
+    hash_header header;
+    header.byte_per_hash = byte_per_hash;
+    header.set_parameters(ctx.n, ctx.bucket_size, ctx.num_buckets);
+    header.engine = engine;
+    header.feature = ctx.feature;
+    header.byte_per_bucket = ctx.byte_per_bucket;
+    header.block_size = block_size;
+    header.seed = (engine == ENGINE_PERMUTE || engine == ENGINE_OPH) ? seed : 0;
+    header.finalize();
+
+    // Prepare the signature engine.
+    ctx.se.init(engine, ctx.num_hash_values, header.seed, kernel);
+
+    // Open the signature cache for records of the same settings (in any
+    // layout). The sampling of n-grams changes the records of large texts.
+    signature_cache cache;
+    if (cache_filename != nullptr) {
+        hash_header row = header;
+        row.block_size = 0;
+        std::string settings = row.describe();
+        if (ctx.max_shingles) {
+            settings += ", max_shingles=" + std::to_string(ctx.max_shingles);
+        }
+        if (!cache.open(cache_filename, ctx.record_size(), base_hash(settings.data(), settings.size()), cache_size << 20)) {
+            es << "ERROR: " << cache.error() << std::endl;
+            return 1;
+        }
+        ctx.cache = &cache;
+    }
+
+    // Process the files in the manifest, or a pair of files.
+    if (manifest_filename != nullptr) {
+        if (std::string_view(manifest_filename) == "-") {
+            return process_manifest(ctx, header, num_threads, is, os, es);
+        }
+        std::ifstream mfs(manifest_filename);
+        if (mfs.fail()) {
+            es << "ERROR: failed to open " << manifest_filename << std::endl;
+            return 1;
+        }
+        return process_manifest(ctx, header, num_threads, mfs, os, es);
+    }
+    return process(ctx, header, num_threads, output_filename, input_filename, os, es);
+}
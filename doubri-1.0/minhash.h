@@ -24,45 +24,326 @@ SOFTWARE.
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <iterator>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <utf8.h>
 #include "MurmurHash3.h"
+#include "hashfile.h"
+#include "utf8_simd.h"
 
-void ngram(const std::string& str, std::vector<std::string>& fs, int n)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MINHASH_X86
+#endif
+
+enum minhash_kernel {
+    KERNEL_AUTO = 0,
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_AVX512,
+};
+
+/*
+    N-grams of a text, represented by views into the text.
+
+    The view refers to the pointers to the letters stored in a buffer that
+    the caller owns and reuses for all texts (e.g., one buffer per thread),
+    so that extracting n-grams allocates no memory for each n-gram.
+*/
+class ngram_view
+{
+protected:
+    const char * const *m_cs;
+    size_t m_num;
+    size_t m_n;
+
+public:
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::string_view value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::string_view* pointer;
+        typedef std::string_view reference;
+
+    protected:
+        const char * const *m_p;
+        size_t m_n;
+
+    public:
+        iterator(const char * const *p, size_t n) : m_p(p), m_n(n)
+        {
+        }
+
+        std::string_view operator*() const
+        {
+            return std::string_view(m_p[0], m_p[m_n] - m_p[0]);
+        }
+
+        iterator& operator++()
+        {
+            ++m_p;
+            return *this;
+        }
+
+        bool operator==(const iterator& rhs) const
+        {
+            return m_p == rhs.m_p;
+        }
+
+        bool operator!=(const iterator& rhs) const
+        {
+            return m_p != rhs.m_p;
+        }
+    };
+
+    ngram_view(const char * const *cs, size_t num, size_t n) : m_cs(cs), m_num(num), m_n(n)
+    {
+    }
+
+    size_t size() const
+    {
+        return m_num;
+    }
+
+    bool empty() const
+    {
+        return m_num == 0;
+    }
+
+    std::string_view operator[](size_t i) const
+    {
+        return std::string_view(m_cs[i], m_cs[i+m_n] - m_cs[i]);
+    }
+
+    iterator begin() const
+    {
+        return iterator(m_cs, m_n);
+    }
+
+    iterator end() const
+    {
+        return iterator(m_cs + m_num, m_n);
+    }
+};
+
+/*
+    Extract letter n-grams from the text whose letters are stored in cs by
+    find_letters(). As before, the letters after a NUL character are ignored.
+*/
+ngram_view ngram_of_letters(std::string_view str, size_t n, std::vector<const char *>& cs)
 {
-    std::vector<const char *> cs;
-    const char *end = str.c_str() + str.size();
+    const char *end = str.data() + str.size();
 
     // Do nothing if the given string is empty.
     if (str.empty()) {
-        return;
+        cs.clear();
+        return ngram_view(cs.data(), 0, n);
     }
 
-    // Store pointers to the unicode characters in the given string.
-    for (const char *p = str.c_str(); *p; utf8::next(p, end)) {
-        cs.push_back(p);
+    // Remove the letters after a NUL character (which is a letter itself).
+    const char *nul = static_cast<const char*>(std::memchr(str.data(), 0, str.size()));
+    if (nul != nullptr) {
+        cs.erase(std::lower_bound(cs.begin(), cs.end(), nul), cs.end());
     }
-    // Add the pointer to the NULL termination of the string.
+    // Add the pointer to the end of the string.
     cs.push_back(end);
 
-    // Append n-grams (note that cs.size() is num_letters + 1).
-    for (int i = 0; i < cs.size()-n; ++i) {
-        const char *b = cs[i];
-        const char *e = cs[i+n];
-        std::string s(b, e-b);
-        fs.push_back(s);
+    // Note that cs.size() is num_letters + 1.
+    return ngram_view(cs.data(), cs.size() > n ? cs.size() - n : 0, n);
+}
+
+/*
+    Extract letter n-grams from the text, storing the pointers to the
+    letters in cs. This throws an exception of utf8::exception when the
+    text is not valid UTF-8.
+*/
+ngram_view ngram(std::string_view str, size_t n, std::vector<const char *>& cs)
+{
+    find_letters(str, cs);
+    return ngram_of_letters(str, n, cs);
+}
+
+/*
+    The seed-independent part of MurmurHash3_x86_32 for a list of n-grams.
+
+    MurmurHash3_x86_32 mixes every 32-bit block of the key before combining
+    it with the state initialized by the seed. Because all hash functions
+    share the same key, the vector kernels mix the blocks once per n-gram and
+    then run the seed-dependent part for 8 (AVX2) or 16 (AVX-512) seeds.
+*/
+struct murmur_keys {
+    std::vector<uint32_t> blocks;   // Mixed 32-bit blocks of all n-grams.
+    std::vector<size_t> offsets;    // Offsets to blocks (one per n-gram + 1).
+    std::vector<uint32_t> tails;    // Mixed tail blocks (0 if no tail).
+    std::vector<uint32_t> lengths;  // Lengths of n-grams in bytes.
+
+    size_t size() const
+    {
+        return lengths.size();
+    }
+
+    template <typename ngrams_type>
+    void set(const ngrams_type& input)
+    {
+        const uint32_t c1 = 0xcc9e2d51;
+        const uint32_t c2 = 0x1b873593;
+
+        blocks.clear();
+        offsets.clear();
+        tails.clear();
+        lengths.clear();
+
+        for (std::string_view s : input) {
+            const uint8_t *data = reinterpret_cast<const uint8_t*>(s.data());
+            const size_t len = s.size();
+            const size_t nblocks = len / 4;
+
+            offsets.push_back(blocks.size());
+            for (size_t i = 0; i < nblocks; ++i) {
+                uint32_t k1;
+                std::memcpy(&k1, data + i * 4, sizeof(k1));
+                k1 *= c1;
+                k1 = (k1 << 15) | (k1 >> 17);
+                k1 *= c2;
+                blocks.push_back(k1);
+            }
+
+            // XORing the state with zero is a no-op, which is exactly what
+            // MurmurHash3_x86_32 does when the key has no tail.
+            const uint8_t *tail = data + nblocks * 4;
+            uint32_t k1 = 0;
+            switch (len & 3) {
+            case 3: k1 ^= tail[2] << 16;
+                    [[fallthrough]];
+            case 2: k1 ^= tail[1] << 8;
+                    [[fallthrough]];
+            case 1: k1 ^= tail[0];
+                    k1 *= c1; k1 = (k1 << 15) | (k1 >> 17); k1 *= c2;
+            }
+            tails.push_back(k1);
+            lengths.push_back(static_cast<uint32_t>(len));
+        }
+        offsets.push_back(blocks.size());
+    }
+};
+
+#ifdef MINHASH_X86
+
+__attribute__((target("avx2")))
+void minhash_avx2(const murmur_keys& keys, uint32_t *output, size_t num)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i n = _mm256_set1_epi32(0xe6546b64);
+    const __m256i f1 = _mm256_set1_epi32(0x85ebca6b);
+    const __m256i f2 = _mm256_set1_epi32(0xc2b2ae35);
+
+    for (size_t i = 0; i < num; i += 8) {
+        const __m256i seed = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), lane);
+        __m256i vmin = _mm256_set1_epi32(-1);
+
+        for (size_t j = 0; j < keys.size(); ++j) {
+            __m256i h = seed;
+            for (size_t k = keys.offsets[j]; k < keys.offsets[j+1]; ++k) {
+                h = _mm256_xor_si256(h, _mm256_set1_epi32(keys.blocks[k]));
+                h = _mm256_or_si256(_mm256_slli_epi32(h, 13), _mm256_srli_epi32(h, 19));
+                h = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(h, 2), h), n);
+            }
+            h = _mm256_xor_si256(h, _mm256_set1_epi32(keys.tails[j] ^ keys.lengths[j]));
+
+            // fmix32
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+            h = _mm256_mullo_epi32(h, f1);
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+            h = _mm256_mullo_epi32(h, f2);
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+
+            vmin = _mm256_min_epu32(vmin, h);
+        }
+
+        uint32_t buffer[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(buffer), vmin);
+        std::memcpy(output + i, buffer, sizeof(uint32_t) * std::min<size_t>(8, num - i));
+    }
+}
+
+__attribute__((target("avx512f")))
+void minhash_avx512(const murmur_keys& keys, uint32_t *output, size_t num)
+{
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i n = _mm512_set1_epi32(0xe6546b64);
+    const __m512i f1 = _mm512_set1_epi32(0x85ebca6b);
+    const __m512i f2 = _mm512_set1_epi32(0xc2b2ae35);
+
+    for (size_t i = 0; i < num; i += 16) {
+        const __m512i seed = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(i)), lane);
+        __m512i vmin = _mm512_set1_epi32(-1);
+
+        for (size_t j = 0; j < keys.size(); ++j) {
+            __m512i h = seed;
+            for (size_t k = keys.offsets[j]; k < keys.offsets[j+1]; ++k) {
+                h = _mm512_xor_si512(h, _mm512_set1_epi32(keys.blocks[k]));
+                h = _mm512_rol_epi32(h, 13);
+                h = _mm512_add_epi32(_mm512_add_epi32(_mm512_slli_epi32(h, 2), h), n);
+            }
+            h = _mm512_xor_si512(h, _mm512_set1_epi32(keys.tails[j] ^ keys.lengths[j]));
+
+            // fmix32
+            h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+            h = _mm512_mullo_epi32(h, f1);
+            h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 13));
+            h = _mm512_mullo_epi32(h, f2);
+            h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+
+            vmin = _mm512_min_epu32(vmin, h);
+        }
+
+        const size_t rest = std::min<size_t>(16, num - i);
+        _mm512_mask_storeu_epi32(output + i, static_cast<__mmask16>((1u << rest) - 1), vmin);
+    }
+}
+
+#endif
+
+/*
+    Resolve KERNEL_AUTO to the widest kernel that the CPU supports. Return
+    KERNEL_AUTO if the requested kernel is unavailable on this CPU.
+*/
+minhash_kernel resolve_kernel(minhash_kernel kernel)
+{
+#ifdef MINHASH_X86
+    const bool avx512 = __builtin_cpu_supports("avx512f");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+#else
+    const bool avx512 = false;
+    const bool avx2 = false;
+#endif
+    switch (kernel) {
+    case KERNEL_AUTO:
+        return avx512 ? KERNEL_AVX512 : (avx2 ? KERNEL_AVX2 : KERNEL_SCALAR);
+    case KERNEL_AVX512:
+        return avx512 ? kernel : KERNEL_AUTO;
+    case KERNEL_AVX2:
+        return avx2 ? kernel : KERNEL_AUTO;
+    default:
+        return kernel;
     }
 }
 
-size_t minhash(const std::vector<std::string> input, uint32_t *output, size_t num)
+template <typename ngrams_type>
+size_t minhash_scalar(const ngrams_type& input, uint32_t *output, size_t num)
 {
     for (size_t i = 0; i < num; ++i) {
         uint32_t min = 0xFFFFFFFF;
-        for (auto it = input.begin(); it != input.end(); ++it) {
+        for (std::string_view s : input) {
             uint32_t hv;
-            MurmurHash3_x86_32(reinterpret_cast<const void*>(it->c_str()), it->size(), i, &hv);
+            MurmurHash3_x86_32(reinterpret_cast<const void*>(s.data()), s.size(), i, &hv);
             if (hv < min) {
                 min = hv;
             }
@@ -71,3 +352,618 @@ size_t minhash(const std::vector<std::string> input, uint32_t *output, size_t nu
     }
     return sizeof(uint32_t) * num;
 }
+
+/*
+    Compute MinHash values of the n-grams with MurmurHash3_x86_32 seeded by
+    0, 1, ..., num-1. The vector kernels produce the values bit-identical to
+    the scalar kernel. The kernel must be resolved by resolve_kernel().
+*/
+template <typename ngrams_type>
+size_t minhash(const ngrams_type& input, uint32_t *output, size_t num, minhash_kernel kernel = KERNEL_SCALAR)
+{
+#ifdef MINHASH_X86
+    if (kernel == KERNEL_AVX2 || kernel == KERNEL_AVX512) {
+        static thread_local murmur_keys keys;
+        keys.set(input);
+        if (kernel == KERNEL_AVX512) {
+            minhash_avx512(keys, output, num);
+        } else {
+            minhash_avx2(keys, output, num);
+        }
+        return sizeof(uint32_t) * num;
+    }
+#endif
+    return minhash_scalar(input, output, num);
+}
+
+/*
+    Hash-once, permute-many MinHash.
+
+    Each n-gram is hashed once into a 64-bit value x, which is reduced
+    modulo the Mersenne prime p = 2^61 - 1. The i-th hash function is the
+    universal permutation h_i(x) = ((a_i x + b_i) mod p) & 0xFFFFFFFF with
+    the coefficients drawn from a pseudo-random sequence initialized by the
+    seed. The product a_i x is computed with 32-bit limbs so that the loop
+    over i vectorizes with 32x32->64-bit multiplications.
+*/
+#define MERSENNE61 ((uint64_t(1) << 61) - 1)
+
+inline uint64_t splitmix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+struct permutations {
+    std::vector<uint32_t> a_lo;     // Lower 32 bits of a_i.
+    std::vector<uint32_t> a_hi;     // Upper 29 bits of a_i.
+    std::vector<uint64_t> b;
+
+    void init(uint64_t seed, size_t num)
+    {
+        uint64_t state = seed;
+        a_lo.resize(num);
+        a_hi.resize(num);
+        b.resize(num);
+        for (size_t i = 0; i < num; ++i) {
+            const uint64_t a = 1 + splitmix64(state) % (MERSENNE61 - 1);
+            a_lo[i] = static_cast<uint32_t>(a);
+            a_hi[i] = static_cast<uint32_t>(a >> 32);
+            b[i] = splitmix64(state) % MERSENNE61;
+        }
+    }
+
+    size_t size() const
+    {
+        return b.size();
+    }
+};
+
+inline uint64_t mod_mersenne61(uint64_t x)
+{
+    x = (x & MERSENNE61) + (x >> 61);
+    return x >= MERSENNE61 ? x - MERSENNE61 : x;
+}
+
+/*
+    Update the MinHash values with the base hash value x (< p).
+*/
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void permute_min(const permutations& perm, uint64_t x, uint32_t *output)
+{
+    const size_t num = perm.size();
+    const uint32_t *a_lo = perm.a_lo.data();
+    const uint32_t *a_hi = perm.a_hi.data();
+    const uint64_t *b = perm.b.data();
+    const uint64_t x0 = static_cast<uint32_t>(x);
+    const uint64_t x1 = x >> 32;
+
+    for (size_t i = 0; i < num; ++i) {
+        // a x = hi 2^64 + mid 2^32 + lo, where 2^64 = 8 and 2^61 = 1 (mod p).
+        const uint64_t lo = a_lo[i] * x0;
+        const uint64_t mid = a_hi[i] * x0 + a_lo[i] * x1;
+        const uint64_t hi = a_hi[i] * x1;
+        uint64_t r =
+            (hi << 3) + (mid >> 29) + ((mid & ((uint64_t(1) << 29) - 1)) << 32) +
+            (lo & MERSENNE61) + (lo >> 61) + b[i];
+        r = (r & MERSENNE61) + (r >> 61);
+        r = r >= MERSENNE61 ? r - MERSENNE61 : r;
+        const uint32_t hv = static_cast<uint32_t>(r);
+        output[i] = hv < output[i] ? hv : output[i];
+    }
+}
+
+/*
+    The 64-bit base hash value of an n-gram.
+*/
+inline uint64_t base_hash(const char *data, size_t size)
+{
+    uint64_t hv[2];
+    MurmurHash3_x64_128(reinterpret_cast<const void*>(data), size, 0, hv);
+    return hv[0];
+}
+
+/*
+    Store the fingerprints of num_buckets buckets of bucket_size MinHash
+    values: the first byte_per_bucket (8 or 16) bytes of the 128-bit
+    MurmurHash3_x64_128 of every bucket.
+*/
+void fingerprint_buckets(const uint32_t *values, size_t num_buckets, size_t bucket_size, size_t byte_per_bucket, uint8_t *output)
+{
+    for (size_t i = 0; i < num_buckets; ++i) {
+        uint64_t hv[2];
+        MurmurHash3_x64_128(reinterpret_cast<const void*>(values + i * bucket_size), sizeof(uint32_t) * bucket_size, 0, hv);
+        std::memcpy(output + i * byte_per_bucket, hv, byte_per_bucket);
+    }
+}
+
+/*
+    The base hash values of n-grams, stored in a buffer of the thread.
+*/
+template <typename ngrams_type>
+const std::vector<uint64_t>& base_hashes(const ngrams_type& input)
+{
+    static thread_local std::vector<uint64_t> xs;
+    xs.clear();
+    for (std::string_view s : input) {
+        xs.push_back(base_hash(s.data(), s.size()));
+    }
+    return xs;
+}
+
+/*
+    MinHash values from the base hash values of count n-grams.
+*/
+size_t minhash_permute(const uint64_t *xs, size_t count, uint32_t *output, const permutations& perm)
+{
+    const size_t num = perm.size();
+    std::fill(output, output + num, 0xFFFFFFFF);
+    for (size_t k = 0; k < count; ++k) {
+        permute_min(perm, mod_mersenne61(xs[k]), output);
+    }
+    return sizeof(uint32_t) * num;
+}
+
+template <typename ngrams_type>
+size_t minhash_permute(const ngrams_type& input, uint32_t *output, const permutations& perm)
+{
+    const auto& xs = base_hashes(input);
+    return minhash_permute(xs.data(), xs.size(), output, perm);
+}
+
+/*
+    MinHash values from MurmurHash3_x64_128, splitting every 128-bit hash
+    value into four 32-bit lanes: the j-th call (seed j) yields the values
+    of the hash functions 4j, 4j+1, 4j+2, and 4j+3.
+*/
+template <typename ngrams_type>
+size_t minhash_murmur128(const ngrams_type& input, uint32_t *output, size_t num)
+{
+    std::fill(output, output + num, 0xFFFFFFFF);
+    for (std::string_view s : input) {
+        for (size_t i = 0; i < num; i += 4) {
+            uint64_t hv[2];
+            MurmurHash3_x64_128(reinterpret_cast<const void*>(s.data()), s.size(), i / 4, hv);
+            const uint32_t lanes[4] = {
+                static_cast<uint32_t>(hv[0]),
+                static_cast<uint32_t>(hv[0] >> 32),
+                static_cast<uint32_t>(hv[1]),
+                static_cast<uint32_t>(hv[1] >> 32),
+            };
+            for (size_t k = 0; k < 4 && i + k < num; ++k) {
+                if (lanes[k] < output[i+k]) {
+                    output[i+k] = lanes[k];
+                }
+            }
+        }
+    }
+    return sizeof(uint32_t) * num;
+}
+
+inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccd;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53;
+    k ^= k >> 33;
+    return k;
+}
+
+/*
+    Map a 32-bit value uniformly to [0, num).
+*/
+inline size_t fastrange(uint32_t x, size_t num)
+{
+    return static_cast<size_t>((static_cast<uint64_t>(x) * num) >> 32);
+}
+
+/*
+    The mask of the sampling that keeps about max n-grams of a document
+    with num n-grams: the n-grams whose fmix64() of the base hash value has
+    the lower k bits of zero, where 2^k is the smallest power of two with
+    num / 2^k <= max (0 when num <= max, keeping all n-grams). Because the
+    decision depends only on the n-gram and the length of the document,
+    near-duplicate documents of similar lengths keep the same n-grams.
+*/
+inline uint64_t sampling_mask(size_t num, size_t max)
+{
+    int k = 0;
+    while ((num >> k) > max) {
+        ++k;
+    }
+    return (uint64_t(1) << k) - 1;
+}
+
+inline bool sampled(uint64_t x, uint64_t mask)
+{
+    return (fmix64(x) & mask) == 0;
+}
+
+/*
+    Remove the base hash values from xs that the sampling does not keep.
+*/
+void sample_hashes(std::vector<uint64_t>& xs, uint64_t mask)
+{
+    xs.erase(std::remove_if(xs.begin(), xs.end(), [mask](uint64_t x) { return !sampled(x, mask); }), xs.end());
+}
+
+/*
+    One permutation hashing (OPH) with optimal densification.
+
+    Every n-gram is hashed once; the upper 32 bits of the hash value select
+    one of num bins and the lower 32 bits compete for the minimum of the
+    bin. A bin that receives no n-gram borrows the value of the first
+    non-empty bin in its own pseudo-random probe sequence, which depends
+    only on the bin number and the seed (Shrivastava, ICML 2017). This makes
+    the collision probability of each bin equal to the Jaccard coefficient.
+*/
+void oph_fill(const uint64_t *xs, size_t count, uint32_t *output, uint8_t *filled, size_t num, uint64_t seed)
+{
+    for (size_t k = 0; k < count; ++k) {
+        const uint64_t hv = fmix64(xs[k] ^ seed);
+        const size_t bin = fastrange(static_cast<uint32_t>(hv >> 32), num);
+        const uint32_t value = static_cast<uint32_t>(hv);
+        if (!filled[bin] || value < output[bin]) {
+            output[bin] = value;
+            filled[bin] = 1;
+        }
+    }
+}
+
+/*
+    Densification (skipped when no bin is filled, i.e., no n-gram).
+*/
+void oph_densify(uint32_t *output, const uint8_t *filled, size_t num, uint64_t seed)
+{
+    if (std::find(filled, filled + num, 1) == filled + num) {
+        return;
+    }
+    for (size_t i = 0; i < num; ++i) {
+        if (!filled[i]) {
+            for (uint64_t attempt = 1; ; ++attempt) {
+                const uint64_t hv = fmix64(seed ^ fmix64((static_cast<uint64_t>(i) << 32) | attempt));
+                const size_t j = fastrange(static_cast<uint32_t>(hv >> 32), num);
+                if (filled[j]) {
+                    output[i] = output[j];
+                    break;
+                }
+            }
+        }
+    }
+}
+
+size_t minhash_oph(const uint64_t *xs, size_t count, uint32_t *output, size_t num, uint64_t seed)
+{
+    static thread_local std::vector<uint8_t> filled;
+    filled.assign(num, 0);
+    std::fill(output, output + num, 0xFFFFFFFF);
+    oph_fill(xs, count, output, filled.data(), num, seed);
+    oph_densify(output, filled.data(), num, seed);
+    return sizeof(uint32_t) * num;
+}
+
+template <typename ngrams_type>
+size_t minhash_oph(const ngrams_type& input, uint32_t *output, size_t num, uint64_t seed)
+{
+    const auto& xs = base_hashes(input);
+    return minhash_oph(xs.data(), xs.size(), output, num, seed);
+}
+
+/*
+    Decode the UTF-8 text into code points. This throws an exception of
+    utf8::exception on a malformed sequence in the same manner as
+    utf8::distance(), and returns the number of code points.
+*/
+size_t decode(std::string_view str, std::vector<uint32_t>& cps)
+{
+    cps.clear();
+    const char *p = str.data();
+    const char *end = str.data() + str.size();
+    while (p != end) {
+        cps.push_back(utf8::next(p, end));
+    }
+    return cps.size();
+}
+
+/*
+    The number of letters (code points) of a valid UTF-8 text, i.e., the
+    number of the bytes that do not continue a sequence.
+*/
+inline size_t count_letters(std::string_view str)
+{
+    size_t num = 0;
+    for (char c : str) {
+        num += (static_cast<uint8_t>(c) & 0xC0) != 0x80;
+    }
+    return num;
+}
+
+/*
+    Move p forward by num letters of a valid UTF-8 text (up to end).
+*/
+inline const char *skip_letters(const char *p, const char *end, size_t num)
+{
+    for (size_t k = 0; k < num && p != end; ++k) {
+        do {
+            ++p;
+        } while (p != end && (static_cast<uint8_t>(*p) & 0xC0) == 0x80);
+    }
+    return p;
+}
+
+inline uint64_t mul_mersenne61(uint64_t a, uint64_t b)
+{
+    const unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+    return mod_mersenne61((static_cast<uint64_t>(r) & MERSENNE61) + static_cast<uint64_t>(r >> 61));
+}
+
+/*
+    The base of the polynomial hash (a fixed random number below p).
+*/
+#define ROLLING_BASE 0x0f3a4c6b8d2e1957ULL
+
+/*
+    Base hash values of the n-grams (windows of n code points) by the rolling
+    polynomial hash H(c_i, ..., c_{i+n-1}) = sum_k c_{i+k} B^{n-1-k} mod p,
+    which slides the window in O(1). As ngram() does, the code points after
+    a NUL character are ignored (ngram() extends the last n-gram to the end
+    of the text instead, which makes a difference only for texts with NUL).
+*/
+void rolling_hashes(const std::vector<uint32_t>& cps, size_t n, std::vector<uint64_t>& xs)
+{
+    xs.clear();
+    const size_t num_letters = std::find(cps.begin(), cps.end(), 0) - cps.begin();
+    if (n == 0 || num_letters < n) {
+        return;
+    }
+
+    // B^{n-1}, the weight of the letter leaving the window.
+    uint64_t top = 1;
+    for (size_t k = 1; k < n; ++k) {
+        top = mul_mersenne61(top, ROLLING_BASE);
+    }
+
+    uint64_t h = 0;
+    for (size_t k = 0; k < n; ++k) {
+        h = mod_mersenne61(mul_mersenne61(h, ROLLING_BASE) + cps[k]);
+    }
+    xs.push_back(h);
+    for (size_t i = n; i < num_letters; ++i) {
+        // Remove c_{i-n}, shift, and append c_i (all values are below p).
+        h = mod_mersenne61(h + MERSENNE61 - mul_mersenne61(cps[i-n], top));
+        h = mod_mersenne61(mul_mersenne61(h, ROLLING_BASE) + cps[i]);
+        xs.push_back(h);
+    }
+}
+
+/*
+    An open-addressing hash set of the shingles (n-grams) of a document.
+    The set is reused for all documents of a thread: reset() only advances
+    the generation number, which marks all slots of older documents empty.
+*/
+class shingle_set
+{
+protected:
+    struct slot {
+        uint64_t key;
+        uint32_t value;
+        uint32_t generation;
+    };
+    std::vector<slot> m_slots;
+    int m_shift = 64;
+    uint32_t m_generation = 0;
+
+public:
+    /*
+        Prepare the set for at most num shingles (with the load below 1/2).
+    */
+    void reset(size_t num)
+    {
+        int bits = 4;
+        while ((size_t(1) << bits) < 2 * num) {
+            ++bits;
+        }
+        m_shift = 64 - bits;
+        if (m_slots.size() < (size_t(1) << bits)) {
+            m_slots.assign(size_t(1) << bits, slot{0, 0, 0});
+            m_generation = 0;
+        }
+        if (++m_generation == 0) {
+            for (auto& s : m_slots) {
+                s.generation = 0;
+            }
+            m_generation = 1;
+        }
+    }
+
+    /*
+        Insert a shingle with its hash value (key) and its index (value).
+        equal(v) tells whether the shingle equals the one of the index v
+        when the keys collide. Return false if the shingle is in the set.
+    */
+    template <typename equal_type>
+    bool insert(uint64_t key, uint32_t value, equal_type equal)
+    {
+        const size_t mask = (size_t(1) << (64 - m_shift)) - 1;
+        for (size_t i = (key * 0x9e3779b97f4a7c15) >> m_shift; ; i = (i + 1) & mask) {
+            slot& s = m_slots[i];
+            if (s.generation != m_generation) {
+                s = slot{key, value, m_generation};
+                return true;
+            } else if (s.key == key && equal(s.value)) {
+                return false;
+            }
+        }
+    }
+};
+
+/*
+    Store the distinct n-grams of the input into output. Because the
+    minimum over a multiset equals the minimum over its set, the engines
+    yield the same MinHash values from the distinct n-grams. A non-zero
+    mask keeps only the n-grams of the sampling.
+*/
+template <typename ngrams_type>
+void unique_ngrams(const ngrams_type& input, shingle_set& set, std::vector<std::string_view>& output, uint64_t mask = 0)
+{
+    output.clear();
+    set.reset(input.size());
+    for (std::string_view s : input) {
+        const uint32_t index = static_cast<uint32_t>(output.size());
+        const uint64_t key = base_hash(s.data(), s.size());
+        if (mask && !sampled(key, mask)) {
+            continue;
+        }
+        if (set.insert(key, index, [&](uint32_t i) { return output[i] == s; })) {
+            output.push_back(s);
+        }
+    }
+}
+
+/*
+    Store the n-grams of the input that the sampling keeps into output.
+*/
+template <typename ngrams_type>
+void sample_ngrams(const ngrams_type& input, std::vector<std::string_view>& output, uint64_t mask)
+{
+    output.clear();
+    for (std::string_view s : input) {
+        if (sampled(base_hash(s.data(), s.size()), mask)) {
+            output.push_back(s);
+        }
+    }
+}
+
+/*
+    Remove duplicated base hash values from xs (keeping the first ones).
+*/
+void unique_hashes(std::vector<uint64_t>& xs, shingle_set& set)
+{
+    set.reset(xs.size());
+    size_t num = 0;
+    for (size_t k = 0; k < xs.size(); ++k) {
+        if (set.insert(xs[k], 0, [](uint32_t) { return true; })) {
+            xs[num++] = xs[k];
+        }
+    }
+    xs.resize(num);
+}
+
+/*
+    The state of a document computed in pieces by a signature engine.
+*/
+struct signature_state {
+    std::vector<uint32_t> values;   // MinHash values of a piece.
+    std::vector<uint8_t> filled;    // Filled bins of OPH.
+};
+
+/*
+    A signature engine with its settings.
+*/
+struct signature_engine {
+    int engine = ENGINE_MURMUR32;
+    size_t num = 0;
+    uint64_t seed = 0;
+    minhash_kernel kernel = KERNEL_SCALAR;
+    permutations perm;
+
+    void init(int engine_, size_t num_, uint64_t seed_, minhash_kernel kernel_)
+    {
+        engine = engine_;
+        num = num_;
+        seed = seed_;
+        kernel = kernel_;
+        if (engine == ENGINE_PERMUTE) {
+            perm.init(seed, num);
+        }
+    }
+
+    /*
+        Whether the engine hashes every n-gram only once into a base hash
+        value (so that compute(xs, count, output) is available).
+    */
+    bool hash_once() const
+    {
+        return engine == ENGINE_PERMUTE || engine == ENGINE_OPH;
+    }
+
+    template <typename ngrams_type>
+    size_t compute(const ngrams_type& features, uint32_t *output) const
+    {
+        switch (engine) {
+        case ENGINE_PERMUTE:
+            return minhash_permute(features, output, perm);
+        case ENGINE_MURMUR128:
+            return minhash_murmur128(features, output, num);
+        case ENGINE_OPH:
+            return minhash_oph(features, output, num, seed);
+        default:
+            return minhash(features, output, num, kernel);
+        }
+    }
+
+    /*
+        Compute MinHash values from the base hash values of n-grams (only
+        for the engines that hash every n-gram once).
+    */
+    size_t compute(const uint64_t *xs, size_t count, uint32_t *output) const
+    {
+        switch (engine) {
+        case ENGINE_PERMUTE:
+            return minhash_permute(xs, count, output, perm);
+        case ENGINE_OPH:
+            return minhash_oph(xs, count, output, num, seed);
+        default:
+            return 0;
+        }
+    }
+
+    /*
+        Compute MinHash values of a document in pieces: begin() initializes
+        the values, update() takes the minimums with the n-grams (or their
+        base hash values) of a piece, and end() finishes the values. Because
+        every engine keeps the minimum of a hash function (or a bin of OPH),
+        the values equal the ones computed from all n-grams at once.
+    */
+    void begin(uint32_t *output, signature_state& state) const
+    {
+        std::fill(output, output + num, 0xFFFFFFFF);
+        state.filled.assign(engine == ENGINE_OPH ? num : 0, 0);
+    }
+
+    template <typename ngrams_type>
+    void update(const ngrams_type& features, uint32_t *output, signature_state& state) const
+    {
+        if (hash_once()) {
+            const auto& xs = base_hashes(features);
+            update(xs.data(), xs.size(), output, state);
+            return;
+        }
+        state.values.resize(num);
+        compute(features, state.values.data());
+        for (size_t i = 0; i < num; ++i) {
+            output[i] = std::min(output[i], state.values[i]);
+        }
+    }
+
+    void update(const uint64_t *xs, size_t count, uint32_t *output, signature_state& state) const
+    {
+        if (engine == ENGINE_PERMUTE) {
+            for (size_t k = 0; k < count; ++k) {
+                permute_min(perm, mod_mersenne61(xs[k]), output);
+            }
+        } else if (engine == ENGINE_OPH) {
+            oph_fill(xs, count, output, state.filled.data(), num, seed);
+        }
+    }
+
+    void end(uint32_t *output, signature_state& state) const
+    {
+        if (engine == ENGINE_OPH) {
+            oph_densify(output, state.filled.data(), num, seed);
+        }
+    }
+};
@@ -0,0 +1,340 @@
+/*
+    A persistent cache of signatures keyed by content fingerprints.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "common.h"
+#include "MurmurHash3.h"
+
+/*
+    A set-associative cache of records (signatures) in a memory-mapped file.
+
+    File layout:
+        char[8]     "MHCache1"
+        uint32_t    header_size (64)
+        uint32_t    record_size
+        uint64_t    settings (a hash value of the settings of signatures)
+        uint64_t    num_sets
+        uint32_t    num_ways
+        uint32_t    (reserved)
+        uint64_t    clock
+        (padding to header_size)
+        entry[num_sets][num_ways]
+
+    Entry:
+        fingerprint128_t key     (the content fingerprint of a document)
+        uint64_t    stamp       (the clock at the last access, 0 if empty)
+        uint64_t    check       (a checksum of the key and the record)
+        char[record_size] record
+
+    A fingerprint selects a set, and a new record replaces the entry of the
+    set that was accessed least recently, so the file never grows beyond
+    the size fixed at its creation. A record whose checksum does not match
+    (e.g., after a crash while writing it) is treated as a miss.
+
+    Processes may share the cache: the file is locked while a process
+    creates or checks it, and an access to a set locks the byte range of
+    the set (with a mutex per set for the threads of a process, because a
+    process does not conflict with its own locks). A lookup or an insertion
+    thus costs two fcntl() calls (locking and unlocking) on top of the
+    mutex, which is small next to extracting and fingerprinting the text.
+*/
+class signature_cache
+{
+protected:
+    static const size_t header_size = 64;
+    static const size_t num_locks = 256;
+
+    int m_fd = -1;
+    char *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_record_size = 0;
+    size_t m_entry_size = 0;
+    uint64_t m_num_sets = 0;
+    uint32_t m_num_ways = 0;
+    uint64_t *m_clock = nullptr;
+    std::mutex m_locks[num_locks];
+    std::string m_error;
+
+public:
+    signature_cache()
+    {
+    }
+
+    signature_cache(const signature_cache&) = delete;
+    signature_cache& operator=(const signature_cache&) = delete;
+
+    virtual ~signature_cache()
+    {
+        close();
+    }
+
+    /*
+        Open the cache file, creating it with the capacity (in bytes) if it
+        does not exist. An existing cache keeps its own capacity but must
+        store records of the same size and settings. Return false with an
+        error message on failure.
+    */
+    bool open(const std::string& filename, size_t record_size, uint64_t settings, size_t capacity, uint32_t num_ways = 8)
+    {
+        close();
+        m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (m_fd < 0) {
+            return fail(std::string("failed to open ") + filename + ": " + std::strerror(errno));
+        }
+        if (flock(m_fd, LOCK_EX) != 0) {
+            return fail(std::string("failed to lock ") + filename + ": " + std::strerror(errno));
+        }
+
+        struct stat st;
+        if (fstat(m_fd, &st) != 0) {
+            return fail(std::string("failed to stat ") + filename + ": " + std::strerror(errno));
+        }
+
+        m_record_size = record_size;
+        m_entry_size = entry_size(record_size);
+        if (st.st_size == 0) {
+            // Create a new cache of the capacity.
+            m_num_ways = num_ways;
+            m_num_sets = std::max<uint64_t>(1, capacity / (m_entry_size * m_num_ways));
+            m_size = header_size + m_num_sets * m_num_ways * m_entry_size;
+            if (ftruncate(m_fd, m_size) != 0) {
+                return fail(std::string("failed to allocate ") + filename + ": " + std::strerror(errno));
+            }
+            if (!map(filename)) {
+                return false;
+            }
+            std::memcpy(m_data, "MHCache1", 8);
+            store<uint32_t>(8, header_size);
+            store<uint32_t>(12, static_cast<uint32_t>(record_size));
+            store<uint64_t>(16, settings);
+            store<uint64_t>(24, m_num_sets);
+            store<uint32_t>(32, m_num_ways);
+        } else {
+            // Use the existing cache.
+            m_size = st.st_size;
+            if (m_size < header_size || !map(filename)) {
+                return m_error.empty() ? fail(std::string("broken cache: ") + filename) : false;
+            }
+            m_num_sets = load<uint64_t>(24);
+            m_num_ways = load<uint32_t>(32);
+            if (std::memcmp(m_data, "MHCache1", 8) != 0 || load<uint32_t>(8) != header_size ||
+                m_size != header_size + m_num_sets * m_num_ways * m_entry_size) {
+                return fail(std::string("broken cache: ") + filename);
+            }
+            if (load<uint32_t>(12) != record_size || load<uint64_t>(16) != settings) {
+                return fail(std::string("the cache stores signatures of different settings: ") + filename);
+            }
+        }
+        m_clock = reinterpret_cast<uint64_t*>(m_data + 40);
+        flock(m_fd, LOCK_UN);
+        return true;
+    }
+
+    void close()
+    {
+        if (m_data != nullptr) {
+            munmap(m_data, m_size);
+        }
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+        m_fd = -1;
+        m_data = nullptr;
+        m_size = 0;
+        m_clock = nullptr;
+    }
+
+    bool is_open() const
+    {
+        return m_data != nullptr;
+    }
+
+    const std::string& error() const
+    {
+        return m_error;
+    }
+
+    /*
+        Copy the record of the fingerprint to record and return true, or
+        return false if the cache does not have it.
+    */
+    bool find(const fingerprint128_t& key, char *record)
+    {
+        const uint64_t set = key[0] % m_num_sets;
+        std::lock_guard<std::mutex> lock(m_locks[set % num_locks]);
+        if (!lock_set(set, F_WRLCK)) {
+            return false;
+        }
+        bool found = false;
+        for (uint32_t w = 0; w < m_num_ways; ++w) {
+            char *entry = entry_at(set, w);
+            uint64_t stamp;
+            std::memcpy(&stamp, entry + 16, sizeof(stamp));
+            if (stamp != 0 && std::memcmp(entry, key.data(), sizeof(key)) == 0) {
+                if (verify(entry)) {
+                    std::memcpy(record, entry + 32, m_record_size);
+                    touch(entry);
+                    found = true;
+                }
+                break;
+            }
+        }
+        lock_set(set, F_UNLCK);
+        return found;
+    }
+
+    /*
+        Store the record of the fingerprint, evicting the least recently
+        used entry of the set if necessary.
+    */
+    void insert(const fingerprint128_t& key, const char *record)
+    {
+        const uint64_t set = key[0] % m_num_sets;
+        std::lock_guard<std::mutex> lock(m_locks[set % num_locks]);
+        if (!lock_set(set, F_WRLCK)) {
+            return;
+        }
+        char *victim = nullptr;
+        uint64_t oldest = UINT64_MAX;
+        for (uint32_t w = 0; w < m_num_ways; ++w) {
+            char *entry = entry_at(set, w);
+            uint64_t stamp;
+            std::memcpy(&stamp, entry + 16, sizeof(stamp));
+            if (stamp != 0 && std::memcmp(entry, key.data(), sizeof(key)) == 0) {
+                victim = entry;     // Overwrite a (possibly broken) entry.
+                break;
+            }
+            if (stamp < oldest) {
+                oldest = stamp;
+                victim = entry;
+            }
+        }
+
+        std::memcpy(victim, key.data(), sizeof(key));
+        std::memcpy(victim + 32, record, m_record_size);
+        const uint64_t check = checksum(victim);
+        std::memcpy(victim + 24, &check, sizeof(check));
+        touch(victim);
+        lock_set(set, F_UNLCK);
+    }
+
+protected:
+    static size_t entry_size(size_t record_size)
+    {
+        // Align entries to 8 bytes.
+        return (32 + record_size + 7) & ~size_t(7);
+    }
+
+    bool fail(const std::string& message)
+    {
+        m_error = message;
+        close();
+        return false;
+    }
+
+    bool map(const std::string& filename)
+    {
+        void *p = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (p == MAP_FAILED) {
+            return fail(std::string("failed to map ") + filename + ": " + std::strerror(errno));
+        }
+        m_data = static_cast<char*>(p);
+        return true;
+    }
+
+    template <typename T>
+    T load(size_t offset) const
+    {
+        T value;
+        std::memcpy(&value, m_data + offset, sizeof(value));
+        return value;
+    }
+
+    template <typename T>
+    void store(size_t offset, T value)
+    {
+        std::memcpy(m_data + offset, &value, sizeof(value));
+    }
+
+    /*
+        Lock (F_WRLCK) or unlock (F_UNLCK) the entries of the set
+        against other processes, waiting for the lock.
+    */
+    bool lock_set(uint64_t set, short type) const
+    {
+        struct flock fl;
+        std::memset(&fl, 0, sizeof(fl));
+        fl.l_type = type;
+        fl.l_whence = SEEK_SET;
+        fl.l_start = header_size + set * m_num_ways * m_entry_size;
+        fl.l_len = m_num_ways * m_entry_size;
+        while (fcntl(m_fd, F_SETLKW, &fl) != 0) {
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    char *entry_at(uint64_t set, uint32_t way) const
+    {
+        return m_data + header_size + (set * m_num_ways + way) * m_entry_size;
+    }
+
+    void touch(char *entry)
+    {
+        const uint64_t stamp = __atomic_add_fetch(m_clock, 1, __ATOMIC_RELAXED);
+        std::memcpy(entry + 16, &stamp, sizeof(stamp));
+    }
+
+    /*
+        A checksum of the record, bound to the key.
+    */
+    uint64_t checksum(const char *entry) const
+    {
+        uint64_t key, hv[2];
+        std::memcpy(&key, entry, sizeof(key));
+        MurmurHash3_x64_128(entry + 32, m_record_size, 0, hv);
+        return hv[0] ^ key;
+    }
+
+    bool verify(const char *entry) const
+    {
+        uint64_t check;
+        std::memcpy(&check, entry + 24, sizeof(check));
+        return check == checksum(entry);
+    }
+};
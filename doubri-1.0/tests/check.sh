@@ -0,0 +1,115 @@
+#!/bin/sh
+#
+# Run the checks of doubri: a check NAME is the script tests/check_NAME.sh,
+# which runs the executables in an empty directory and calls fail (or
+# exits with an error) when the results are not the expected ones. The
+# first lines of a script describe what it checks.
+#
+# USAGE: check.sh TEST PREFIX WORKDIR
+#     TEST      the name of a check, or all
+#     PREFIX    the path prefix of the executables (e.g., build/doubri-)
+#     WORKDIR   the directory for the files of the checks
+
+set -e
+
+if [ $# -ne 3 ]; then
+    echo "USAGE: $0 TEST PREFIX WORKDIR" >&2
+    exit 2
+fi
+TEST=$1
+BIN=$2
+WORK=$3
+TESTS=$(cd "$(dirname "$0")" && pwd)
+
+fail()
+{
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+same()
+{
+    cmp -s "$1" "$2" || fail "$1 and $2 differ"
+}
+
+# Write a JSONL corpus of $1 documents: random texts, their near and exact
+# duplicates, escapes, non-ASCII letters, long texts, and other fields.
+corpus()
+{
+    awk -v n="$1" 'BEGIN {
+        srand(13);
+        nw = split("doubri minhash bucket index flag record hash shingle dedup corpus web text ja en 日本語 コーパス 重複 除去 テキスト 🍣", w, " ");
+        for (i = 0; i < n; ++i) {
+            r = rand();
+            if (i > 10 && r < 0.15) {
+                t[i] = t[int(rand() * i)];
+            } else if (i > 10 && r < 0.35) {
+                s = t[int(rand() * i)];
+                sub(/ [^ ]* [^ ]*$/, "", s);
+                t[i] = w[1 + int(rand() * nw)] " " s;
+            } else {
+                m = (rand() < 0.01) ? 3000 : 5 + int(rand() * 100);
+                s = "";
+                for (k = 0; k < m; ++k) {
+                    s = s w[1 + int(rand() * nw)] ((rand() < 0.1) ? "\\n" : " ");
+                }
+                if (rand() < 0.2) {
+                    s = s "\\\"quoted\\\" \\\\ \\u3042\\u3044 \\ud83c\\udf63 \\t";
+                }
+                t[i] = s;
+            }
+            if (i % 5 == 0) {
+                printf("{\"id\": %d, \"meta\": {\"text\": \"no\", \"tags\": [1, 2]}, \"text\": \"%s\"}\n", i, t[i]);
+            } else if (i % 7 == 0) {
+                printf("{ \"text\" : \"%s\" , \"id\" : %d }\n", t[i], i);
+            } else {
+                printf("{\"text\": \"%s\"}\n", t[i]);
+            }
+        }
+    }'
+}
+
+# Deduplicate tests/golden.jsonl in two groups (the first 200 documents,
+# then the last 100 documents against the index of the first group), with
+# the options $1 of doubri-minhash, and print the checksums of the MinHash
+# files, the flag files, the index, and the documents kept.
+pipeline()
+{
+    head -n 200 "$TESTS/golden.jsonl" > a.jsonl
+    tail -n 100 "$TESTS/golden.jsonl" > b.jsonl
+    for f in a b; do
+        ${BIN}minhash $1 $f.mh < $f.jsonl > /dev/null
+        ${BIN}init $f.mh > $f.mh.f
+    done
+    echo a.mh | ${BIN}self index > /dev/null
+    echo b.mh > targets.txt
+    ${BIN}other index targets.txt > /dev/null 2>&1
+    ${BIN}apply a.mh.f < a.jsonl > a.out.jsonl
+    ${BIN}apply b.mh.f < b.jsonl > b.out.jsonl
+    cksum a.mh b.mh a.mh.f b.mh.f
+    cat index.[0-9]* | cksum
+    cksum a.out.jsonl b.out.jsonl
+}
+
+run()
+{
+    [ -f "$TESTS/check_$1.sh" ] || fail "unknown test: $1"
+    rm -rf "$WORK/$1"
+    mkdir -p "$WORK/$1"
+    (cd "$WORK/$1" || exit 1; . "$TESTS/check_$1.sh")
+    echo "PASS: $1"
+}
+
+case "$BIN" in
+    /*) ;;
+    *) BIN="$(pwd)/$BIN" ;;
+esac
+
+if [ "$TEST" = all ]; then
+    for f in "$TESTS"/check_*.sh; do
+        t=${f##*/check_}
+        run "${t%.sh}"
+    done
+else
+    run "$TEST"
+fi
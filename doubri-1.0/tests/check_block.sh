@@ -0,0 +1,20 @@
+# The blocked column-major layout (--block) keeps the same documents of
+# tests/golden.jsonl as the row-major layout, and doubri-other --by-bucket
+# drops the same documents as doubri-other in either layout.
+
+pipeline "" | tail -n 5 > rows.sum
+pipeline "--block 64" | tail -n 5 > blocks.sum
+same rows.sum blocks.sum
+
+for opts in "" "--block 64" "--block 7 --fingerprint 64"; do
+    for f in a b; do
+        ${BIN}minhash $opts $f.mh < $f.jsonl > /dev/null
+        ${BIN}init $f.mh > $f.mh.f
+    done
+    echo a.mh | ${BIN}self index > /dev/null
+    ${BIN}other index targets.txt > /dev/null 2>&1
+    mv b.mh.f records.f
+    ${BIN}init b.mh > b.mh.f
+    ${BIN}other --by-bucket index targets.txt > /dev/null
+    same records.f b.mh.f
+done
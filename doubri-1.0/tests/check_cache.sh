@@ -0,0 +1,24 @@
+# The signature cache (--cache) writes the same MinHash files as computing
+# the records, finds every record of a second run in the cache, and can be
+# shared by concurrent processes.
+
+corpus 2000 > corpus.jsonl
+${BIN}minhash plain.mh < corpus.jsonl > /dev/null
+${BIN}minhash --cache sig.cache --cache-size 64 first.mh < corpus.jsonl > /dev/null
+same plain.mh first.mh
+${BIN}minhash --cache sig.cache second.mh < corpus.jsonl > second.log
+same plain.mh second.mh
+grep -q '"num_records": 2000, "num_cache_hits": 2000' second.log || fail "the second run missed the cache: $(cat second.log)"
+
+rm -f sig.cache
+for k in 1 2 3 4; do
+    ${BIN}minhash --cache sig.cache --cache-size 64 -j 2 p$k.mh < corpus.jsonl > p$k.log &
+done
+wait
+for k in 1 2 3 4; do
+    same plain.mh p$k.mh
+done
+
+if ${BIN}minhash --cache sig.cache --engine permute c.mh < corpus.jsonl > /dev/null 2>&1; then
+    fail "the cache accepted the records of other settings"
+fi
@@ -0,0 +1,25 @@
+# doubri-minhash computes a long text in pieces (--chunk) with the same
+# MinHash values as at once, and the cap of n-grams (--max-shingles)
+# writes the MinHash files and keeps the documents of tests/golden.jsonl as
+# it did when it was added.
+
+corpus 2000 > corpus.jsonl
+for opts in "" "--engine permute" "--engine oph --seed 7"; do
+    ${BIN}minhash $opts --chunk 4096 chunk.mh < corpus.jsonl > /dev/null
+    ${BIN}minhash $opts --chunk 0 whole.mh < corpus.jsonl > /dev/null
+    same whole.mh chunk.mh
+done
+
+pipeline "--max-shingles 50" > actual.sum
+cat > expected.sum <<END
+2492632985 640024 a.mh
+2045540989 320024 b.mh
+2424499745 200 a.mh.f
+3019897774 100 b.mh.f
+973207012 489600
+896230621 37562 a.out.jsonl
+2658913880 16425 b.out.jsonl
+END
+same expected.sum actual.sum
+${BIN}minhash --max-shingles 50 c.mh < a.jsonl > c.log
+grep -q '"num_capped": [1-9]' c.log || fail "no document was capped: $(cat c.log)"
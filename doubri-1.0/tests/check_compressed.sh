@@ -0,0 +1,17 @@
+# doubri-apply --compress writes gzip and zstd streams (when the build
+# supports the format), and doubri-minhash and doubri-apply read them as
+# the plain JSONL.
+
+corpus 1000 > corpus.jsonl
+${BIN}minhash plain.mh < corpus.jsonl > /dev/null
+${BIN}init plain.mh > plain.mh.f
+for format in gzip zstd; do
+    if ! ${BIN}apply --compress $format plain.mh.f < corpus.jsonl > corpus.$format 2> apply.log; then
+        grep -q "cannot write" apply.log || fail "doubri-apply --compress $format"
+        continue
+    fi
+    ${BIN}minhash $format.mh < corpus.$format > /dev/null
+    same plain.mh $format.mh
+    ${BIN}apply plain.mh.f < corpus.$format > $format.jsonl
+    same corpus.jsonl $format.jsonl
+done
@@ -0,0 +1,12 @@
+# The content fingerprints (--content) keep the same documents of
+# tests/golden.jsonl as comparing the buckets, and doubri-minhash removes
+# the stale content file of a MinHash file written without them.
+
+pipeline "" > buckets.sum
+pipeline "--content" > content.sum
+same buckets.sum content.sum
+[ -s a.mh.content ] || fail "doubri-minhash --content wrote no content file"
+[ -s index.content ] || fail "doubri-self wrote no content file of the index"
+
+${BIN}minhash a.mh < a.jsonl > /dev/null
+[ ! -e a.mh.content ] || fail "doubri-minhash left a stale content file"
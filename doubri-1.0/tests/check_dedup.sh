@@ -0,0 +1,9 @@
+# Hashing every distinct n-gram of a document once writes the same MinHash
+# files as hashing every occurrence of an n-gram (--no-dedup).
+
+corpus 2000 > corpus.jsonl
+for opts in "" "--engine murmur128" "--engine permute" "--engine oph --feature rolling"; do
+    ${BIN}minhash $opts once.mh < corpus.jsonl > /dev/null
+    ${BIN}minhash $opts --no-dedup every.mh < corpus.jsonl > /dev/null
+    same once.mh every.mh
+done
@@ -0,0 +1,39 @@
+# doubri-other --drop-log and doubri-flagmerge yield the same flags as
+# doubri-other updating the flag files in place, and doubri-other
+# --by-bucket fails on a missing MinHash file after updating the other ones.
+
+corpus 3000 > corpus.jsonl
+head -n 1000 corpus.jsonl > a.jsonl
+sed -n '1001,2000p' corpus.jsonl > b.jsonl
+tail -n 1000 corpus.jsonl > c.jsonl
+for f in a b c; do
+    ${BIN}minhash --content $f.mh < $f.jsonl > /dev/null
+    ${BIN}init $f.mh > $f.mh.f
+done
+echo a.mh | ${BIN}self index > /dev/null
+printf "b.mh\nc.mh\n" > targets.txt
+cp b.mh.f b.orig.f
+cp c.mh.f c.orig.f
+
+for mode in "" "--by-bucket"; do
+    ${BIN}other $mode index targets.txt > /dev/null 2>&1
+    mv b.mh.f b.inplace.f
+    mv c.mh.f c.inplace.f
+    cp b.orig.f b.mh.f
+    cp c.orig.f c.mh.f
+    ${BIN}other $mode --drop-log pass index targets.txt > /dev/null 2>&1
+    same b.orig.f b.mh.f
+    same c.orig.f c.mh.f
+    for f in b c; do
+        ${BIN}flagmerge --remove $f.mh.f $f.mh.pass.drop > /dev/null
+        same $f.inplace.f $f.mh.f
+        cp $f.orig.f $f.mh.f
+    done
+done
+
+printf "b.mh\nmissing.mh\nc.mh\n" > missing.txt
+if ${BIN}other --by-bucket index missing.txt > /dev/null 2>&1; then
+    fail "doubri-other --by-bucket ignored a missing MinHash file"
+fi
+same b.inplace.f b.mh.f
+same c.inplace.f c.mh.f
@@ -0,0 +1,34 @@
+# The fingerprints of buckets write the MinHash files and the index as they
+# did when they were added, and keep the same documents of tests/golden.jsonl
+# as the MinHash values.
+
+cat > expected.64 <<END
+3939296278 64064 a.mh
+4149529205 32064 b.mh
+2192386419 200 a.mh.f
+2510515335 100 b.mh.f
+2552571367 48640
+4131102071 37384 a.out.jsonl
+2975937116 16242 b.out.jsonl
+END
+cat > expected.128 <<END
+1313994713 128064 a.mh
+1871582560 64064 b.mh
+2192386419 200 a.mh.f
+2510515335 100 b.mh.f
+3545147142 97280
+4131102071 37384 a.out.jsonl
+2975937116 16242 b.out.jsonl
+END
+
+pipeline "" | tail -n 2 > values.sum
+for bits in 64 128; do
+    pipeline "--fingerprint $bits" > actual.$bits
+    same expected.$bits actual.$bits
+    tail -n 2 actual.$bits > kept.sum
+    same values.sum kept.sum
+done
+
+if ${BIN}minhash --fingerprint 32 c.mh < a.jsonl > /dev/null 2>&1; then
+    fail "doubri-minhash accepted --fingerprint 32"
+fi
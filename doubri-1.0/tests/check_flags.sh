@@ -0,0 +1,28 @@
+# The bit-packed flag files hold the same flags as the text ones through
+# doubri-init, doubri-self, doubri-apply, and doubri-flagconv, and
+# doubri-apply reads a text flag file with a trailing newline.
+
+corpus 1000 > corpus.jsonl
+${BIN}minhash a.mh < corpus.jsonl > /dev/null
+${BIN}init a.mh > a.mh.f
+${BIN}init --packed a.mh > packed.f
+${BIN}flagconv --to text packed.f > /dev/null
+same a.mh.f packed.f
+
+echo a.mh | ${BIN}self index > /dev/null
+cp a.mh.f text.f
+${BIN}flagconv --to packed a.mh.f > /dev/null
+${BIN}apply a.mh.f < corpus.jsonl > packed.jsonl
+${BIN}apply text.f < corpus.jsonl > text.jsonl
+same text.jsonl packed.jsonl
+${BIN}flagconv --to text a.mh.f > /dev/null
+same text.f a.mh.f
+
+${BIN}init --packed a.mh > a.mh.f
+echo a.mh | ${BIN}self index > /dev/null
+${BIN}flagconv --to text a.mh.f > /dev/null
+same text.f a.mh.f
+
+printf '\r\n' >> a.mh.f
+${BIN}apply a.mh.f < corpus.jsonl > newline.jsonl
+same text.jsonl newline.jsonl
@@ -0,0 +1,26 @@
+# doubri-self and doubri-other write the flags back to the flag files
+# without leaving temporary files, and read a text flag file with a
+# trailing newline (\n or \r\n) as the one without it.
+
+pipeline "" > plain.sum
+cp a.mh.f a.plain.f
+cp b.mh.f b.plain.f
+if ls | grep -q tmp; then
+    fail "temporary files are left: $(ls)"
+fi
+
+for nl in '\n' '\r\n'; do
+    ${BIN}init a.mh > a.mh.f
+    ${BIN}init b.mh > b.mh.f
+    printf "$nl" >> a.mh.f
+    printf "$nl" >> b.mh.f
+    echo a.mh | ${BIN}self index > /dev/null
+    ${BIN}other index targets.txt > /dev/null 2>&1
+    same a.plain.f a.mh.f
+    same b.plain.f b.mh.f
+done
+
+printf '1 1\n' > a.mh.f
+if echo a.mh | ${BIN}self index > /dev/null 2>&1; then
+    fail "doubri-self accepted a space in the flag file"
+fi
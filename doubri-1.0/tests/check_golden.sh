@@ -0,0 +1,15 @@
+# The default settings write the same MinHash files (version 1), flag
+# files, and index as the first release of doubri, and keep the same
+# documents of tests/golden.jsonl.
+
+pipeline "" > actual.sum
+cat > expected.sum <<END
+1226444206 640024 a.mh
+3690133175 320024 b.mh
+2192386419 200 a.mh.f
+2510515335 100 b.mh.f
+2147780707 486400
+4131102071 37384 a.out.jsonl
+2975937116 16242 b.out.jsonl
+END
+same expected.sum actual.sum
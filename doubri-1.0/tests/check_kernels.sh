@@ -0,0 +1,17 @@
+# The SIMD kernels (AVX2 and AVX-512, when the CPU supports them) and the
+# automatic choice of doubri-minhash write the same MinHash files as the
+# scalar kernel.
+
+corpus 2000 > corpus.jsonl
+for opts in "" "-n 3 -b 9 -r 7" "--engine murmur128" "--engine oph --seed 7"; do
+    ${BIN}minhash $opts --kernel scalar scalar.mh < corpus.jsonl > /dev/null
+    for kernel in avx2 avx512; do
+        if ${BIN}minhash $opts --kernel $kernel $kernel.mh < corpus.jsonl > /dev/null 2> kernel.log; then
+            same scalar.mh $kernel.mh
+        elif ! grep -q "does not support" kernel.log; then
+            fail "doubri-minhash --kernel $kernel $opts"
+        fi
+    done
+    ${BIN}minhash $opts --self-check 1 auto.mh < corpus.jsonl > /dev/null
+    same scalar.mh auto.mh
+done
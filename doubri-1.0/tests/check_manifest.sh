@@ -0,0 +1,17 @@
+# doubri-minhash --manifest writes the same MinHash files as a run per
+# file, also with files processed at the same time (-j).
+
+corpus 2000 > corpus.jsonl
+head -n 1500 corpus.jsonl > a.jsonl
+tail -n 500 corpus.jsonl > b.jsonl
+: > c.jsonl
+for f in a b c; do
+    ${BIN}minhash $f.mh $f.jsonl > /dev/null
+done
+printf "m1a.mh a.jsonl\nm1b.mh b.jsonl\nm1c.mh c.jsonl\n" > manifest.txt
+${BIN}minhash --manifest manifest.txt > /dev/null
+sed 's/m1/m3/g' manifest.txt | ${BIN}minhash -j 3 --manifest - > /dev/null
+for f in a b c; do
+    same $f.mh m1$f.mh
+    same $f.mh m3$f.mh
+done
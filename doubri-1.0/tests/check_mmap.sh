@@ -0,0 +1,18 @@
+# doubri-minhash reads a plain JSONL_FILE through a memory map (and a
+# compressed one as a stream) with the same results as reading STDIN, also
+# for a file without the last newline and an empty file.
+
+corpus 1000 > corpus.jsonl
+printf '%s' "$(cat corpus.jsonl)" > partial.jsonl
+: > empty.jsonl
+for f in corpus partial empty; do
+    ${BIN}minhash stream.mh < $f.jsonl > /dev/null
+    ${BIN}minhash mapped.mh $f.jsonl > /dev/null
+    same stream.mh mapped.mh
+done
+${BIN}minhash plain.mh < corpus.jsonl > /dev/null
+${BIN}init plain.mh > plain.mh.f
+if ${BIN}apply --compress gzip plain.mh.f < corpus.jsonl > corpus.gz 2> /dev/null; then
+    ${BIN}minhash gzip.mh corpus.gz > /dev/null
+    same plain.mh gzip.mh
+fi
@@ -0,0 +1,14 @@
+# The murmur128 engine writes the MinHash files (version 2) and keeps the
+# documents of tests/golden.jsonl as it did when it was added.
+
+pipeline "--engine murmur128" > actual.sum
+cat > expected.sum <<END
+563774130 640064 a.mh
+2857992939 320064 b.mh
+213714678 200 a.mh.f
+4135410699 100 b.mh.f
+3664541748 496000
+1126567333 37810 a.out.jsonl
+1232556336 16453 b.out.jsonl
+END
+same expected.sum actual.sum
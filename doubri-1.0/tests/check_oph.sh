@@ -0,0 +1,14 @@
+# The oph engine writes the MinHash files (version 2) and keeps the
+# documents of tests/golden.jsonl as it did when it was added.
+
+pipeline "--engine oph --seed 7" > actual.sum
+cat > expected.sum <<END
+2867066167 640064 a.mh
+3476623988 320064 b.mh
+213714678 200 a.mh.f
+4052467469 100 b.mh.f
+514954507 496000
+1126567333 37810 a.out.jsonl
+3610915803 16366 b.out.jsonl
+END
+same expected.sum actual.sum
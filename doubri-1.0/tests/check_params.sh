@@ -0,0 +1,31 @@
+# The parameters n, b, and r write the MinHash files and the index as they
+# did when they were added, doubri-minhash rejects invalid values of them,
+# and doubri-self fails without writing the index when a MinHash file of
+# the group has other parameters.
+
+pipeline "-n 3 -b 9 -r 7" > actual.sum
+cat > expected.sum <<END
+2086653232 50464 a.mh
+2219613280 25264 b.mh
+1298214547 200 a.mh.f
+1845653423 100 b.mh.f
+2798811888 37548
+772303961 36567 a.out.jsonl
+1530702330 15982 b.out.jsonl
+END
+same expected.sum actual.sum
+
+for opts in "-n 0" "-b x" "-r 65537" "-b 1024 -r 1025" "-j 0" "--seed -1"; do
+    if ${BIN}minhash $opts c.mh < a.jsonl > /dev/null 2>&1; then
+        fail "doubri-minhash accepted $opts"
+    fi
+done
+
+rm -f index.*
+${BIN}minhash -b 9 c.mh < b.jsonl > /dev/null
+${BIN}init a.mh > a.mh.f
+${BIN}init c.mh > c.mh.f
+if printf "a.mh\nc.mh\n" | ${BIN}self index > /dev/null 2>&1; then
+    fail "doubri-self accepted MinHash files of different parameters"
+fi
+[ ! -e index.header ] || fail "doubri-self wrote the index of a failed group"
@@ -0,0 +1,5 @@
+# The JSON scanner of doubri-minhash extracts the same texts as
+# nlohmann/json (doubri-bench --parse).
+
+corpus 2000 > corpus.jsonl
+${BIN}bench --parse < corpus.jsonl > parse.log || fail "doubri-bench --parse: $(cat parse.log)"
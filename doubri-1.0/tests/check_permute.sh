@@ -0,0 +1,27 @@
+# The permute engine writes the MinHash files (version 2) and keeps the
+# documents of tests/golden.jsonl as it did when it was added, with the
+# default seed and another one.
+
+pipeline "--engine permute" > actual.sum
+cat > expected.sum <<END
+4162546155 640064 a.mh
+259618565 320064 b.mh
+1898946177 200 a.mh.f
+4135410699 100 b.mh.f
+1942962285 489600
+3099272132 37442 a.out.jsonl
+1232556336 16453 b.out.jsonl
+END
+same expected.sum actual.sum
+
+pipeline "--engine permute --seed 7" > actual.sum
+cat > expected.sum <<END
+2828812121 640064 a.mh
+2116698980 320064 b.mh
+2531577274 200 a.mh.f
+1090824698 100 b.mh.f
+234623309 492800
+3327643836 37607 a.out.jsonl
+2060841012 16387 b.out.jsonl
+END
+same expected.sum actual.sum
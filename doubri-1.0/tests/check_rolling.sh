@@ -0,0 +1,33 @@
+# The rolling feature of the permute and oph engines writes the MinHash
+# files and keeps the documents of tests/golden.jsonl as it did when it was
+# added, and the other engines refuse it.
+
+pipeline "--engine permute --feature rolling" > actual.sum
+cat > expected.sum <<END
+2532873890 640064 a.mh
+1611294677 320064 b.mh
+1898946177 200 a.mh.f
+4052467469 100 b.mh.f
+3840500093 489600
+3099272132 37442 a.out.jsonl
+3610915803 16366 b.out.jsonl
+END
+same expected.sum actual.sum
+
+pipeline "--engine oph --feature rolling --seed 7" > actual.sum
+cat > expected.sum <<END
+4248229325 640064 a.mh
+4219726193 320064 b.mh
+1898946177 200 a.mh.f
+396964892 100 b.mh.f
+404970954 489600
+3099272132 37442 a.out.jsonl
+800394729 16130 b.out.jsonl
+END
+same expected.sum actual.sum
+
+for engine in murmur32 murmur128; do
+    if ${BIN}minhash --engine $engine --feature rolling c.mh < a.jsonl > /dev/null 2>&1; then
+        fail "doubri-minhash --engine $engine accepted --feature rolling"
+    fi
+done
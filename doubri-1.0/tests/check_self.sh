@@ -0,0 +1,19 @@
+# doubri-self -j N writes the same flag files and index as -j 1.
+
+corpus 3000 > corpus.jsonl
+head -n 1500 corpus.jsonl > a.jsonl
+tail -n 1500 corpus.jsonl > b.jsonl
+for opts in "" "--fingerprint 64 --content" "-n 3 -b 9 -r 7 --block 100"; do
+    for j in 1 4; do
+        rm -rf j$j
+        mkdir j$j
+        for f in a b; do
+            ${BIN}minhash $opts j$j/$f.mh < $f.jsonl > /dev/null
+            ${BIN}init j$j/$f.mh > j$j/$f.mh.f
+        done
+        printf "j$j/a.mh\nj$j/b.mh\n" | ${BIN}self -j $j j$j/index > j$j/self.log
+    done
+    for f in j1/*; do
+        same $f j4/${f#j1/}
+    done
+done
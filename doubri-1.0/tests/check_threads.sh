@@ -0,0 +1,8 @@
+# doubri-minhash -j N writes the same MinHash files as a single thread.
+
+corpus 2000 > corpus.jsonl
+for opts in "" "--engine permute" "--engine oph --seed 7"; do
+    ${BIN}minhash $opts single.mh < corpus.jsonl > /dev/null
+    ${BIN}minhash $opts -j 3 threads.mh < corpus.jsonl > /dev/null
+    same single.mh threads.mh
+done
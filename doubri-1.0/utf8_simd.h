@@ -0,0 +1,253 @@
+/*
+    Find the letters of UTF-8 text with SIMD instructions.
+
+Copyright (c) 2023-2024, Naoaki Okazaki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include <utf8.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_SIMD_X86
+#endif
+
+/*
+    Store the pointers to all letters (code points) of the text in cs with
+    the scalar decoder, which throws an exception of utf8::exception on a
+    malformed sequence exactly as utf8::distance() does.
+*/
+inline size_t find_letters_scalar(std::string_view str, std::vector<const char *>& cs)
+{
+    const char *p = str.data();
+    const char *end = str.data() + str.size();
+    cs.clear();
+    while (p != end) {
+        cs.push_back(p);
+        utf8::next(p, end);
+    }
+    return cs.size();
+}
+
+#ifdef UTF8_SIMD_X86
+
+/*
+    UTF-8 validation by table lookups (Keiser and Lemire, "Validating UTF-8
+    in less than one instruction per byte", Software: Practice and Experience,
+    2021). Every error in a pair of adjacent bytes sets a bit in all three of
+    the lookups by the high nibble of the first byte, the low nibble of the
+    first byte, and the high nibble of the second byte.
+*/
+#define UTF8_TOO_SHORT      (1 << 0)    // 11______ 0_______ or 11______ 11______
+#define UTF8_TOO_LONG       (1 << 1)    // 0_______ 10______
+#define UTF8_OVERLONG_3     (1 << 2)    // 11100000 100_____
+#define UTF8_TOO_LARGE      (1 << 3)    // 11110100 1001____ or larger
+#define UTF8_SURROGATE      (1 << 4)    // 11101101 101_____
+#define UTF8_OVERLONG_2     (1 << 5)    // 1100000_ 10______
+#define UTF8_TOO_LARGE_1000 (1 << 6)    // 11110101 1000____ or larger
+#define UTF8_OVERLONG_4     (1 << 6)    // 11110000 1000____
+#define UTF8_TWO_CONTS      (1 << 7)    // 10______ 10______
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/*
+    The bytes of input shifted by N bytes, with the last N bytes of prev.
+*/
+template <int N>
+__attribute__((target("avx2")))
+inline __m256i utf8_prev(__m256i input, __m256i prev)
+{
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+}
+
+__attribute__((target("avx2")))
+inline __m256i utf8_high_nibble(__m256i v)
+{
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+__attribute__((target("avx2")))
+inline __m256i utf8_lookup(__m256i index,
+    char t0, char t1, char t2, char t3, char t4, char t5, char t6, char t7,
+    char t8, char t9, char t10, char t11, char t12, char t13, char t14, char t15)
+{
+    const __m256i table = _mm256_setr_epi8(
+        t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15,
+        t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15
+        );
+    return _mm256_shuffle_epi8(table, index);
+}
+
+/*
+    Return non-zero bytes where input (following prev) is malformed.
+*/
+__attribute__((target("avx2")))
+inline __m256i utf8_check(__m256i input, __m256i prev)
+{
+    const __m256i prev1 = utf8_prev<1>(input, prev);
+
+    const __m256i byte_1_high = utf8_lookup(utf8_high_nibble(prev1),
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+        );
+
+    const __m256i byte_1_low = utf8_lookup(_mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)),
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+        );
+
+    const __m256i byte_2_high = utf8_lookup(utf8_high_nibble(input),
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+        );
+
+    const __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    // The third and fourth bytes of 3- and 4-byte sequences must be
+    // continuation bytes (the pair check above flags them as TWO_CONTS).
+    const __m256i prev2 = utf8_prev<2>(input, prev);
+    const __m256i prev3 = utf8_prev<3>(input, prev);
+    const __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80));
+    const __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80));
+    const __m256i must23 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must23, special);
+}
+
+/*
+    Return non-zero bytes if input ends with an incomplete sequence.
+*/
+__attribute__((target("avx2")))
+inline __m256i utf8_incomplete(__m256i input)
+{
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)
+        );
+    return _mm256_subs_epu8(input, max);
+}
+
+/*
+    Store the pointers to all letters of the text in cs, 32 bytes at a time.
+    A letter starts at every byte that is not a continuation byte (10xxxxxx).
+    Return false if the text is malformed.
+*/
+__attribute__((target("avx2")))
+inline bool find_letters_avx2(std::string_view str, std::vector<const char *>& cs)
+{
+    const char *p = str.data();
+    const char *end = str.data() + str.size();
+    const __m256i cont = _mm256_set1_epi8((char)0xC0);
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+
+    cs.clear();
+    cs.reserve(str.size() + 1);
+
+    while (p < end) {
+        // The last block is padded with NUL characters (ASCII).
+        const size_t size = std::min<size_t>(end - p, 32);
+        __m256i input;
+        if (size == 32) {
+            input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        } else {
+            alignas(32) char buffer[32] = {0};
+            std::memcpy(buffer, p, size);
+            input = _mm256_load_si256(reinterpret_cast<const __m256i*>(buffer));
+        }
+
+        if (_mm256_movemask_epi8(input) == 0) {
+            // ASCII characters only.
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = _mm256_setzero_si256();
+        } else {
+            error = _mm256_or_si256(error, utf8_check(input, prev));
+            prev_incomplete = utf8_incomplete(input);
+        }
+        prev = input;
+
+        // Continuation bytes are 0x80-0xBF, i.e., (signed) -128 to -65.
+        const __m256i is_cont = _mm256_cmpgt_epi8(cont, input);
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(is_cont));
+        if (size < 32) {
+            mask &= (1u << size) - 1;
+        }
+        while (mask) {
+            cs.push_back(p + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+        p += size;
+    }
+
+    error = _mm256_or_si256(error, prev_incomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+#endif
+
+/*
+    Store the pointers to all letters (code points) of the text in cs and
+    return the number of letters. This throws an exception of
+    utf8::exception on malformed UTF-8 exactly when utf8::distance() does.
+*/
+inline size_t find_letters(std::string_view str, std::vector<const char *>& cs)
+{
+#ifdef UTF8_SIMD_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        if (find_letters_avx2(str, cs)) {
+            return cs.size();
+        }
+        // Let the scalar decoder throw the same exception as before.
+    }
+#endif
+    return find_letters_scalar(str, cs);
+}